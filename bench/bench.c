@@ -0,0 +1,344 @@
+#include "clog.h"
+#include <gifbuf/gifbuf.h>
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Re-encodes the test corpus with every encoder setting and prints the
+   resulting image data sizes. Run from the repository root. */
+
+static const char* corpus[] = {
+    "test/test-images/cat16.gif",    "test/test-images/cat64.gif",
+    "test/test-images/cat256.gif",   "test/test-images/woman256.gif",
+    "test/test-images/test.gif",     "test/test-images/bird512.gif",
+};
+
+/* The clear strategies, followed by GIF_EFFORT_MAX. */
+#define BENCH_COLUMNS (GIF_CLEAR_EARLY + 2)
+
+static const char* column_names[BENCH_COLUMNS] = {
+    "on-full", "deferred", "adaptive", "early", "max",
+};
+
+static unsigned char*
+read_file_to_buffer(const char* filename, size_t* file_size)
+{
+    FILE* file = fopen(filename, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    *file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    unsigned char* buffer = (unsigned char*)malloc(*file_size);
+    if (fread(buffer, 1, *file_size, file) != *file_size) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return buffer;
+}
+
+static double
+now_ms(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1000.0 + time.tv_nsec / 1000000.0;
+}
+
+/* Whether the exported file decodes back to the colours of gif_object. */
+static bool
+round_trips(const GIFObject* gif_object, const char* path)
+{
+    size_t size = 0;
+    unsigned char* bytes = read_file_to_buffer(path, &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+
+    size_t pixel_amount =
+      (size_t)gif_object->metadata.width * gif_object->metadata.height;
+    bool equal = true;
+    size_t i = 0;
+    for (i = 0; i < pixel_amount && equal; i++) {
+        equal = memcmp(imported.color_table[imported.indices[i]],
+                       gif_object->color_table[gif_object->indices[i]],
+                       sizeof(GIFColor)) == 0;
+    }
+
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    return equal;
+}
+
+static void
+bench_clear_strategies(void)
+{
+    printf("\nImage data bytes per clear strategy and at max effort\n");
+    printf("%-32s", "image");
+    size_t s = 0;
+    for (s = 0; s < BENCH_COLUMNS; s++)
+        printf("%12s", column_names[s]);
+    printf("\n");
+
+    size_t totals[BENCH_COLUMNS] = { 0 };
+    double times[BENCH_COLUMNS] = { 0 };
+    size_t f = 0;
+    for (f = 0; f < sizeof(corpus) / sizeof(corpus[0]); f++) {
+        size_t size = 0;
+        unsigned char* bytes = read_file_to_buffer(corpus[f], &size);
+        if (bytes == NULL)
+            continue;
+        GIFObject gif_object = { 0 };
+        gif_import(bytes, &gif_object);
+
+        printf("%-32s", corpus[f]);
+        for (s = 0; s < BENCH_COLUMNS; s++) {
+            GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                         .clear_strategy = s,
+                                         .max_block_length = 254 };
+            if (s > GIF_CLEAR_EARLY) {
+                options.clear_strategy = GIF_CLEAR_ON_FULL;
+                options.effort = GIF_EFFORT_MAX;
+            }
+            double start = now_ms();
+            GIFExportStats stats =
+              gif_export_ex(gif_object, &options, "out/bench.gif");
+            times[s] += now_ms() - start;
+            totals[s] += stats.compressed_size;
+            printf("%11zu%s",
+                   stats.compressed_size,
+                   round_trips(&gif_object, "out/bench.gif") ? " " : "!");
+        }
+        printf("\n");
+
+        free(gif_object.indices);
+        free(gif_object.color_table);
+        free(bytes);
+    }
+
+    printf("%-32s", "total");
+    for (s = 0; s < BENCH_COLUMNS; s++)
+        printf("%11zu ", totals[s]);
+    printf("\n%-32s", "relative to on-full");
+    for (s = 0; s < BENCH_COLUMNS; s++)
+        printf("%+10.2f%% ", 100.0 * ((double)totals[s] / totals[0] - 1));
+    printf("\n%-32s", "encode ms");
+    for (s = 0; s < BENCH_COLUMNS; s++)
+        printf("%11.1f ", times[s]);
+    printf("\n");
+}
+
+static const uint32_t lossy_thresholds[] = { 0, 4, 8, 16, 32 };
+
+/* Mean squared channel error of the exported file against gif_object. */
+static double
+decoded_error(const GIFObject* gif_object, const char* path)
+{
+    size_t size = 0;
+    unsigned char* bytes = read_file_to_buffer(path, &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+
+    size_t pixel_amount =
+      (size_t)gif_object->metadata.width * gif_object->metadata.height;
+    double error = 0;
+    size_t i = 0;
+    int c = 0;
+    for (i = 0; i < pixel_amount; i++) {
+        for (c = 0; c < 3; c++) {
+            double d = imported.color_table[imported.indices[i]][c] -
+                       gif_object->color_table[gif_object->indices[i]][c];
+            error += d * d;
+        }
+    }
+
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    return pixel_amount > 0 ? error / (pixel_amount * 3) : 0;
+}
+
+static void
+bench_lossy(void)
+{
+    const size_t amount = sizeof(lossy_thresholds) / sizeof(lossy_thresholds[0]);
+    printf("\nImage data bytes and mean squared error per lossy threshold\n");
+    printf("%-32s", "image");
+    size_t t = 0;
+    for (t = 0; t < amount; t++)
+        printf("%10s%-3u", "lossy ", lossy_thresholds[t]);
+    printf("\n");
+
+    size_t totals[sizeof(lossy_thresholds) / sizeof(lossy_thresholds[0])] = {
+        0
+    };
+    size_t f = 0;
+    for (f = 0; f < sizeof(corpus) / sizeof(corpus[0]); f++) {
+        size_t size = 0;
+        unsigned char* bytes = read_file_to_buffer(corpus[f], &size);
+        if (bytes == NULL)
+            continue;
+        GIFObject gif_object = { 0 };
+        gif_import(bytes, &gif_object);
+
+        printf("%-32s", corpus[f]);
+        for (t = 0; t < amount; t++) {
+            GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                         .clear_strategy = GIF_CLEAR_ADAPTIVE,
+                                         .max_block_length = 254,
+                                         .lossy = lossy_thresholds[t] };
+            GIFExportStats stats =
+              gif_export_ex(gif_object, &options, "out/bench.gif");
+            totals[t] += stats.compressed_size;
+            printf("%7zu %5.1f",
+                   stats.compressed_size,
+                   decoded_error(&gif_object, "out/bench.gif"));
+        }
+        printf("\n");
+
+        free(gif_object.indices);
+        free(gif_object.color_table);
+        free(bytes);
+    }
+
+    printf("%-32s", "relative to lossless");
+    for (t = 0; t < amount; t++)
+        printf("%+12.2f%%", 100.0 * ((double)totals[t] / totals[0] - 1));
+    printf("\n");
+}
+
+/* Imports per corpus file, to time the decoder. */
+#define DECODE_REPEATS 20
+
+/* Best import time of bytes over DECODE_REPEATS runs. */
+static double
+decode_time(const unsigned char* bytes, const GIFImportOptions* options)
+{
+    double best = INFINITY;
+    int r = 0;
+    for (r = 0; r < DECODE_REPEATS; r++) {
+        GIFObject gif_object = { 0 };
+        double start = now_ms();
+        gif_import_ex(bytes, options, &gif_object);
+        best = fmin(best, now_ms() - start);
+        free(gif_object.indices);
+        free(gif_object.color_table);
+    }
+    return best;
+}
+
+static void
+bench_decode(void)
+{
+    printf("\nDecode ms per image, best of %d\n", DECODE_REPEATS);
+    printf("%-32s%12s%12s\n", "image", "full", "1/4");
+    double totals[2] = { 0 };
+    size_t f = 0;
+    for (f = 0; f < sizeof(corpus) / sizeof(corpus[0]); f++) {
+        size_t size = 0;
+        unsigned char* bytes = read_file_to_buffer(corpus[f], &size);
+        if (bytes == NULL)
+            continue;
+        const GIFImportOptions downscaled = { .downscale = 4 };
+        double full = decode_time(bytes, NULL);
+        double quarter = decode_time(bytes, &downscaled);
+        totals[0] += full;
+        totals[1] += quarter;
+        printf("%-32s%12.3f%12.3f\n", corpus[f], full, quarter);
+        free(bytes);
+    }
+    printf("%-32s%12.3f%12.3f\n", "total", totals[0], totals[1]);
+}
+
+static const char* filter_names[] = { "box", "bilinear", "lanczos3" };
+
+/* Thumbnail pipeline of the largest corpus image: decode to RGBA, resample
+   to a quarter and quantise. */
+static void
+bench_resample(void)
+{
+    const char* path = "test/test-images/bird512.gif";
+    size_t size = 0;
+    unsigned char* bytes = read_file_to_buffer(path, &size);
+    if (bytes == NULL)
+        return;
+    GIFProbeInfo info = { 0 };
+    gif_probe(bytes, size, &info);
+    const uint16_t width = info.width / 4;
+    const uint16_t height = info.height / 4;
+    unsigned char* rgba = malloc((size_t)info.width * info.height * 4);
+    unsigned char* small = malloc((size_t)width * height * 4);
+
+    printf("\nResample ms of %s to %ux%u, best of %d\n",
+           path,
+           width,
+           height,
+           DECODE_REPEATS);
+    printf("%-32s%12s%12s%12s\n", "filter", "1 thread", "threads", "quantize");
+    int f = 0;
+    for (f = 0; f < 3; f++) {
+        double best[3] = { INFINITY, INFINITY, INFINITY };
+        int r = 0;
+        for (r = 0; r < DECODE_REPEATS; r++) {
+            GIFObject gif_object = { 0 };
+            GIFPixelBuffer buffer = { .pixels = rgba,
+                                      .stride = (size_t)info.width * 4,
+                                      .format = GIF_PIXEL_RGBA };
+            gif_import_into(bytes, NULL, &buffer, &gif_object);
+            free(gif_object.color_table);
+
+            int t = 0;
+            for (t = 0; t < 2; t++) {
+                GIFResampleOptions options = { .filter = f,
+                                               .thread_count = t == 0 };
+                double start = now_ms();
+                gif_resample_rgba(rgba,
+                                  buffer.stride,
+                                  info.width,
+                                  info.height,
+                                  small,
+                                  (size_t)width * 4,
+                                  width,
+                                  height,
+                                  &options);
+                best[t] = fmin(best[t], now_ms() - start);
+            }
+
+            GIFQuantizeOptions quantize_options = { .max_colors = 256 };
+            double start = now_ms();
+            gif_quantize(small, width, height, &quantize_options, &gif_object);
+            best[2] = fmin(best[2], now_ms() - start);
+            free(gif_object.indices);
+            free(gif_object.color_table);
+        }
+        printf("%-32s%12.3f%12.3f%12.3f\n",
+               filter_names[f],
+               best[0],
+               best[1],
+               best[2]);
+    }
+    free(small);
+    free(rgba);
+    free(bytes);
+}
+
+int
+main(void)
+{
+    clog_log_level_set(CLOG_LOG_LEVEL_ERROR);
+    bench_clear_strategies();
+    bench_lossy();
+    bench_decode();
+    bench_resample();
+    return 0;
+}
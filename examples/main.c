@@ -51,37 +51,22 @@ main(void)
     size_t size = 0;
     unsigned char* bytes =
       read_file_to_buffer("test/test-images/woman256.gif", &size);
-    GIFObject gif_object = { 0 };
+    GIFProbeInfo info = { 0 };
+    gif_probe(bytes, size, &info);
     clog_log_level_set(CLOG_LOG_LEVEL_INFO);
-    gif_import(bytes, &gif_object);
-
-    uint32_t* pixels = malloc(gif_object.metadata.width *
-                              gif_object.metadata.height * sizeof(uint32_t));
-
-    // Fill with something (gradient)
-    int x, y = 0;
-    for (y = 0; y < screenHeight; y++) {
-        for (x = 0; x < screenWidth; x++) {
-            unsigned char r =
-              gif_object
-                .color_table[gif_object.indices[y * screenWidth + x]][0];
-            unsigned char g =
-              gif_object
-                .color_table[gif_object.indices[y * screenWidth + x]][1];
-            unsigned char b =
-              gif_object
-                .color_table[gif_object.indices[y * screenWidth + x]][2];
-            unsigned char a = 255;
-            pixels[y * screenWidth + x] = ((uint32_t)a << 24) |
-                                          ((uint32_t)b << 16) |
-                                          ((uint32_t)g << 8) | ((uint32_t)r);
-        }
-    }
+
+    // Decode straight into the RGBA pixels handed to raylib
+    uint32_t* pixels = malloc(info.width * info.height * sizeof(uint32_t));
+    GIFPixelBuffer buffer = { .pixels = (uint8_t*)pixels,
+                              .stride = info.width * sizeof(uint32_t),
+                              .format = GIF_PIXEL_RGBA };
+    GIFObject gif_object = { 0 };
+    gif_import_into(bytes, NULL, &buffer, &gif_object);
 
     // Create a raylib Image from pixel buffer
     Image image = { .data = pixels,
-                    .width = screenWidth,
-                    .height = screenHeight,
+                    .width = info.width,
+                    .height = info.height,
                     .mipmaps = 1,
                     .format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
 
@@ -90,6 +75,8 @@ main(void)
 
     // Now we can free the CPU buffer if we don’t need to update per-frame
     free(pixels);
+    free(gif_object.color_table);
+    free(bytes);
 
     SetTargetFPS(60);
 
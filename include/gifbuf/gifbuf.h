@@ -43,19 +43,400 @@ typedef struct
 typedef struct
 {
     GIFMetadata metadata;
+    /* The table the indices refer to. For an image with a local colour table
+       (0x80 in metadata.local_color_table) that is the local one, with
+       gct_size_n giving its size. */
     GIFColor* color_table;
     GIFGraphicControl graphic_control;
     uint8_t* indices;
+    /* Bytes from one row of indices to the next, 0 for rows right after
+       each other. With indices pointing into a larger canvas the object is
+       a view of part of it, which export reads in place. */
+    size_t stride;
 } GIFObject;
 
+typedef struct
+{
+    uint16_t left;
+    uint16_t top;
+    uint16_t width;
+    uint16_t height;
+} GIFRect;
+
+typedef enum
+{
+    GIF_DISTANCE_RGB,
+    GIF_DISTANCE_WEIGHTED_RGB,
+    GIF_DISTANCE_LAB
+} GIFColorDistance;
+
+typedef struct
+{
+    GIFColorDistance distance;
+    bool has_transparent_index;
+    uint8_t transparent_index;
+    uint8_t alpha_threshold;
+    uint8_t thread_count;
+} GIFPaletteMapperOptions;
+
+typedef struct GIFPaletteMapper GIFPaletteMapper;
+
+typedef enum
+{
+    GIF_DITHER_NONE,
+    GIF_DITHER_ORDERED,
+    GIF_DITHER_ERROR_DIFFUSION,
+} GIFDitherMethod;
+
+typedef struct
+{
+    GIFDitherMethod method;
+    float strength;
+} GIFDitherOptions;
+
+typedef struct
+{
+    uint16_t max_colors;
+    bool refine;
+    uint8_t refine_iterations;
+    uint8_t alpha_threshold;
+    uint8_t thread_count;
+    GIFColorDistance distance;
+    GIFDitherOptions dither;
+} GIFQuantizeOptions;
+
+typedef enum
+{
+    GIF_CLEAR_ON_FULL,
+    GIF_CLEAR_DEFERRED,
+    GIF_CLEAR_ADAPTIVE,
+    GIF_CLEAR_EARLY
+} GIFClearStrategy;
+
+typedef enum
+{
+    /* Frames use config->color_table, written up front, unless
+       gif_animation_set_palette gives them a local one. */
+    GIF_PALETTE_GLOBAL,
+    /* The palette can change between frames: the first one is written as
+       the global colour table, later ones as local tables. RGBA frames are
+       quantized into a new one when the current one stops fitting, indexed
+       frames use config->color_table or the one last set. */
+    GIF_PALETTE_LOCAL
+} GIFPaletteMode;
+
+typedef struct
+{
+    GIFMetadata metadata;
+    GIFColor* color_table;
+    uint16_t loop_count;
+    size_t lzw_hashmap_max_length;
+    GIFClearStrategy clear_strategy;
+    size_t max_block_length;
+    bool optimize;
+    bool has_transparent_index;
+    uint8_t transparent_index;
+    bool merge_duplicates;
+    uint32_t near_duplicate_threshold;
+    GIFPaletteMode palette_mode;
+    GIFQuantizeOptions quantize;
+    uint32_t sample_stride;
+    float palette_error_threshold;
+    /* Lossy LZW threshold of the frames, see GIFExportOptions.lossy. Can be
+       changed between frames with gif_animation_set_lossy. */
+    uint32_t lossy;
+} GIFAnimationConfig;
+
+typedef struct GIFAnimation GIFAnimation;
+
+typedef enum
+{
+    GIF_PIXEL_INDEX,
+    /* Four bytes per pixel, alpha 0 for the transparent index. */
+    GIF_PIXEL_RGBA,
+    GIF_PIXEL_BGRA,
+    /* Indices packed two or four to a byte, the first pixel in the high
+       bits. Rows start on a byte, see gif_row_bytes. The palette has to fit:
+       16 colours at most for INDEX4, 4 for INDEX2. */
+    GIF_PIXEL_INDEX4,
+    GIF_PIXEL_INDEX2
+} GIFPixelFormat;
+
+typedef enum
+{
+    GIF_PALETTE_ORDER_NONE,
+    GIF_PALETTE_ORDER_FREQUENCY,
+    GIF_PALETTE_ORDER_CHAIN
+} GIFPaletteOrder;
+
+typedef enum
+{
+    GIF_EFFORT_DEFAULT,
+    GIF_EFFORT_MAX
+} GIFExportEffort;
+
+typedef struct
+{
+    size_t lzw_hashmap_max_length;
+    GIFClearStrategy clear_strategy;
+    size_t max_block_length;
+    bool minimize_palette;
+    GIFPaletteOrder palette_order;
+    GIFExportEffort effort;
+    /* Lossy LZW: a match may continue with a colour within this distance of
+       the pixel's own, roughly the per channel difference of a grey. 0 keeps
+       the image exact. */
+    uint32_t lossy;
+    /* Writes the rows in the four interlace passes, so that a viewer can
+       show every eighth row after the first eighth of the data. Images
+       imported with the interlace bit set are written interlaced anyway. */
+    bool interlace;
+    /* Layout of the indices, GIF_PIXEL_INDEX4 or INDEX2 to read packed rows
+       as gif_import_into writes them. */
+    GIFPixelFormat index_format;
+} GIFExportOptions;
+
+/* Called as the indices of gif_object fill in: after each of the four passes
+   of an interlaced image, once at the end otherwise. Rows of later passes
+   are still zero. */
+typedef void (*GIFProgressCallback)(const GIFObject* gif_object,
+                                    uint8_t pass,
+                                    uint8_t pass_count,
+                                    void* user_data);
+
+typedef struct
+{
+    GIFProgressCallback progress;
+    void* user_data;
+    /* Points color_table into file_data instead of at a copy. file_data has
+       to outlive the object then, and color_table is not to be freed. */
+    bool borrow_color_table;
+    /* Decodes at 1/downscale of the size, e.g. 2, 4 or 8, sampling the middle
+       index of every downscale by downscale block. metadata.width and height
+       give the smaller size. 0 or 1 decodes in full. */
+    uint8_t downscale;
+    /* Decodes only this part of the image, before any downscale. left, top,
+       width and height of the metadata become those of the region. The
+       decode stops after its last row. A width or height of 0 decodes the
+       whole image. */
+    GIFRect region;
+} GIFImportOptions;
+
+/* Caller owned pixels to decode into, stride bytes apart from row to row,
+   e.g. a mapped texture or part of an atlas. */
+typedef struct
+{
+    uint8_t* pixels;
+    size_t stride;
+    GIFPixelFormat format;
+} GIFPixelBuffer;
+
+typedef enum
+{
+    GIF_FLIP_HORIZONTAL,
+    GIF_FLIP_VERTICAL
+} GIFFlip;
+
+/* Clockwise. */
+typedef enum
+{
+    GIF_ROTATE_90,
+    GIF_ROTATE_180,
+    GIF_ROTATE_270
+} GIFRotation;
+
+typedef enum
+{
+    /* The mean of the source pixels under each pixel, nearest neighbour
+       when enlarging. */
+    GIF_FILTER_BOX,
+    GIF_FILTER_BILINEAR,
+    /* Sharpest of the three, at three source pixels either side. */
+    GIF_FILTER_LANCZOS3
+} GIFFilter;
+
+typedef struct
+{
+    GIFFilter filter;
+    uint8_t thread_count;
+} GIFResampleOptions;
+
+/* What gif_probe finds without decoding any image data. */
+typedef struct
+{
+    uint16_t width;
+    uint16_t height;
+    size_t frame_count;
+    /* Sum of the frame delays in hundredths of a second. */
+    uint32_t duration;
+    /* Whether there is a NETSCAPE2.0 loop extension, a loop_count of 0 loops
+       forever. */
+    bool has_loop_count;
+    uint16_t loop_count;
+} GIFProbeInfo;
+
+typedef struct
+{
+    size_t file_size;
+    size_t compressed_size;
+    /* Change of compressed_size through the chosen palette order, measured
+       with GIF_EFFORT_MAX and lossy only. */
+    ptrdiff_t palette_order_delta;
+    GIFClearStrategy clear_strategy;
+    /* Whether the image data came from the optimal parse, GIF_EFFORT_MAX
+       only. */
+    bool optimal_parse;
+} GIFExportStats;
+
+bool
+gif_probe(const uint8_t* data, size_t length, GIFProbeInfo* info);
 void
 gif_import(const uint8_t* file_data, GIFObject* gif_object);
+void
+gif_import_ex(const uint8_t* file_data,
+              const GIFImportOptions* options,
+              GIFObject* gif_object);
+/* Decodes into buffer, which has to hold the image at the size the options
+   give, see gif_probe and gif_row_bytes. indices stays NULL and rows the
+   data ends before are left as they were. */
+void
+gif_import_into(const uint8_t* file_data,
+                const GIFImportOptions* options,
+                const GIFPixelBuffer* buffer,
+                GIFObject* gif_object);
 
 void
 gif_export(GIFObject gif_object,
            size_t lzw_hashmap_max_length,
            size_t max_block_length,
            const char* out_path);
+GIFExportStats
+gif_export_ex(GIFObject gif_object,
+              const GIFExportOptions* options,
+              const char* out_path);
+
+GIFAnimation*
+gif_animation_begin(const GIFAnimationConfig* config, const char* out_path);
+void
+gif_animation_add_frame(GIFAnimation* animation,
+                        const uint8_t* indices,
+                        uint16_t delay_time);
+void
+gif_animation_add_frame_rgba(GIFAnimation* animation,
+                             const uint8_t* rgba,
+                             uint16_t delay_time);
+void
+gif_animation_set_lossy(GIFAnimation* animation, uint32_t lossy);
+void
+gif_animation_set_palette(GIFAnimation* animation,
+                          const GIFColor* colors,
+                          uint8_t size_n);
+void
+gif_animation_end(GIFAnimation* animation);
+
+/* Part of gif_object as a view of its indices, see GIFObject.stride. rect
+   is cut to the image, which keeps its position. Not for packed indices. */
+GIFObject
+gif_crop(const GIFObject* gif_object, GIFRect rect);
+/* Operations on the indices of an image or animation frame, which keep
+   their palette. Rows of src and dst are src_stride and dst_stride bytes
+   apart, and the two do not overlap. */
+void
+gif_indices_flip(const uint8_t* src,
+                 size_t src_stride,
+                 uint16_t width,
+                 uint16_t height,
+                 GIFFlip flip,
+                 uint8_t* dst,
+                 size_t dst_stride);
+/* dst is height wide and width high for a quarter turn. */
+void
+gif_indices_rotate(const uint8_t* src,
+                   size_t src_stride,
+                   uint16_t width,
+                   uint16_t height,
+                   GIFRotation rotation,
+                   uint8_t* dst,
+                   size_t dst_stride);
+/* Nearest neighbour: every pixel of dst takes the index under its middle. */
+void
+gif_indices_resize(const uint8_t* src,
+                   size_t src_stride,
+                   uint16_t width,
+                   uint16_t height,
+                   uint8_t* dst,
+                   size_t dst_stride,
+                   uint16_t dst_width,
+                   uint16_t dst_height);
+
+/* Resizes RGBA pixels, as gif_import_into writes them, for gif_quantize.
+   Rows of src and dst are src_stride and dst_stride bytes apart, and the
+   two do not overlap. Colours are weighed by their alpha, so transparent
+   pixels do not bleed into their neighbours. */
+void
+gif_resample_rgba(const uint8_t* src,
+                  size_t src_stride,
+                  uint16_t width,
+                  uint16_t height,
+                  uint8_t* dst,
+                  size_t dst_stride,
+                  uint16_t dst_width,
+                  uint16_t dst_height,
+                  const GIFResampleOptions* options);
+
+/* Bytes of a row of width pixels in format, without padding. */
+size_t
+gif_row_bytes(uint16_t width, GIFPixelFormat format);
+void
+gif_pack_indices(const uint8_t* indices,
+                 size_t count,
+                 GIFPixelFormat format,
+                 uint8_t* packed);
+void
+gif_unpack_indices(const uint8_t* packed,
+                   size_t count,
+                   GIFPixelFormat format,
+                   uint8_t* indices);
+
+void
+gif_quantize(const uint8_t* rgba,
+             uint16_t width,
+             uint16_t height,
+             const GIFQuantizeOptions* options,
+             GIFObject* gif_object);
+/* Sets the metadata and a color_table shared by all frames in config, which
+   the caller frees after gif_animation_end. A transparent index is reserved
+   for frames with transparent pixels and for optimize, after the colours,
+   and when has_transparent_index was already set, at transparent_index. */
+void
+gif_quantize_frames(const uint8_t* const* frames,
+                    size_t frame_count,
+                    GIFAnimationConfig* config);
+
+GIFPaletteMapper*
+gif_palette_mapper_create(const GIFColor* colors,
+                          uint16_t color_amount,
+                          const GIFPaletteMapperOptions* options);
+void
+gif_palette_mapper_destroy(GIFPaletteMapper* mapper);
+uint8_t
+gif_palette_mapper_map_color(GIFPaletteMapper* mapper,
+                             uint8_t r,
+                             uint8_t g,
+                             uint8_t b);
+void
+gif_palette_mapper_map(GIFPaletteMapper* mapper,
+                       const uint8_t* rgba,
+                       size_t pixel_amount,
+                       uint8_t* out_indices);
+
+void
+gif_dither(GIFPaletteMapper* mapper,
+           const uint8_t* rgba,
+           uint16_t width,
+           uint16_t height,
+           const GIFDitherOptions* options,
+           uint8_t* out_indices);
 
 size_t
 gif_read_header(const uint8_t* header, GIFVersion* version);
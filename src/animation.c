@@ -0,0 +1,658 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+#include "simd.h"
+
+#define DISPOSAL_NONE 1
+#define DISPOSAL_BACKGROUND 2
+
+/* Allowed increase of the mean channel error over what a local palette
+   scored on the frame it was built for. */
+#define ANIMATION_DEFAULT_PALETTE_ERROR 2.0f
+
+/* Frames are written one behind: the disposal method of a frame can only be
+   chosen once the frame after it is known. */
+struct GIFAnimation
+{
+    GIFAnimationConfig config;
+    FILE* file;
+    size_t pixel_amount;
+
+    /* What a decoder shows before the pending frame is drawn. */
+    u8* canvas;
+    /* Indices of the pending frame, i.e. the last frame added. */
+    u8* previous;
+    u8* scratch;
+    u64 previous_hash;
+
+    bool has_pending;
+    /* Written in full and without masking, as for the first frame or after a
+       palette switch. */
+    bool pending_is_key;
+    GIFRect pending_rect;
+    u16 pending_delay;
+    u32 pending_lossy;
+
+    /* Palette of frames added from now on. Palette 0 is the global colour
+       table, every later one is written as a local colour table. */
+    GIFColor palette[256];
+    u8 palette_size_n;
+    u32 palette_id;
+    bool palette_changed;
+    GIFColor pending_palette[256];
+    u8 pending_palette_size_n;
+    u32 pending_palette_id;
+    bool header_written;
+
+    /* RGBA frames. The last frame and its indices are kept so that pixels
+       that did not change keep their index, whatever the dither did. */
+    GIFPaletteMapper* mapper;
+    float mapper_error;
+    u8* rgba_previous;
+    u8* rgba_indices;
+    u8* rgba_scratch;
+    bool has_rgba_previous;
+
+    size_t frame_count;
+    size_t merged_count;
+    size_t bytes_written;
+};
+
+static void
+animation_write_arena(GIFAnimation* animation, VArena* arena)
+{
+    fwrite(arena->base, sizeof(char), arena->used, animation->file);
+    animation->bytes_written += arena->used;
+}
+
+static void
+animation_write_header(GIFAnimation* animation)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    VArena gif_data;
+    varena_init_ex(&gif_data, GIF_ALLOC_SIZE, system_page_size(), 1);
+    gif_write_header(&gif_data, config->metadata.version);
+    gif_write_logical_screen_descriptor(&gif_data, &config->metadata);
+    if (config->metadata.has_gct) {
+        gif_write_global_color_table(&gif_data, config->color_table);
+    }
+    gif_write_loop_extension(&gif_data, config->loop_count);
+    animation_write_arena(animation, &gif_data);
+    varena_destroy(&gif_data);
+    animation->header_written = true;
+}
+
+/* Whether indices can be dropped in favour of the pending frame. Exact
+   duplicates are found through the content hash, near duplicates differ in at
+   most near_duplicate_threshold pixels. */
+static bool
+animation_is_duplicate(const GIFAnimation* animation, const u8* indices, u64 hash)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    if (animation->palette_changed)
+        return false;
+    if (hash == animation->previous_hash &&
+        simd_first_diff(indices, animation->previous, animation->pixel_amount) ==
+          animation->pixel_amount) {
+        return true;
+    }
+    if (config->near_duplicate_threshold == 0)
+        return false;
+
+    return simd_count_diff(indices,
+                           animation->previous,
+                           animation->pixel_amount,
+                           config->near_duplicate_threshold) <=
+           config->near_duplicate_threshold;
+}
+
+static GIFRect
+rect_union(GIFRect a, GIFRect b)
+{
+    u16 left = min(a.left, b.left);
+    u16 top = min(a.top, b.top);
+    u16 right = max(a.left + a.width, b.left + b.width);
+    u16 bottom = max(a.top + a.height, b.top + b.height);
+    return (GIFRect){
+        .left = left, .top = top, .width = right - left, .height = bottom - top
+    };
+}
+
+/* Bounding box of the pixels where a and b differ. Rows are only compared
+   outside the columns already known to have changed. */
+static bool
+animation_diff_rect(const u8* a, const u8* b, u16 width, u16 height, GIFRect* rect)
+{
+    size_t top = 0;
+    size_t left = width;
+    while (top < height) {
+        left = simd_first_diff(a + top * width, b + top * width, width);
+        if (left < width)
+            break;
+        top++;
+    }
+    if (top == height)
+        return false;
+
+    size_t right =
+      simd_last_diff(a + top * width, b + top * width, width);
+
+    size_t bottom = height;
+    while (bottom - 1 > top) {
+        size_t row = (bottom - 1) * width;
+        size_t first = simd_first_diff(a + row, b + row, width);
+        if (first < width) {
+            left = min(left, first);
+            right = max(right, simd_last_diff(a + row, b + row, width));
+            break;
+        }
+        bottom--;
+    }
+
+    size_t y = 0;
+    for (y = top + 1; y + 1 < bottom; y++) {
+        size_t row = y * width;
+        size_t first = simd_first_diff(a + row, b + row, left);
+        if (first < left)
+            left = first;
+        size_t last =
+          simd_last_diff(a + row + right, b + row + right, width - right);
+        if (last)
+            right += last;
+    }
+
+    *rect = (GIFRect){ .left = left,
+                       .top = top,
+                       .width = right - left,
+                       .height = bottom - top };
+    return true;
+}
+
+/* Bounding box of the pixels that turn transparent in next while being opaque
+   in prev. Those cannot be drawn over prev and require prev to be disposed. */
+static bool
+animation_cleared_rect(const u8* next,
+                       const u8* prev,
+                       u16 width,
+                       u16 height,
+                       u8 transparent_index,
+                       GIFRect* rect)
+{
+    bool found = false;
+    size_t left = width, right = 0, top = 0, bottom = 0;
+    size_t y = 0;
+    for (y = 0; y < height; y++) {
+        size_t first = 0, last = 0;
+        simd_key_span(next + y * width,
+                      prev + y * width,
+                      width,
+                      transparent_index,
+                      &first,
+                      &last);
+        if (first == last)
+            continue;
+        if (!found)
+            top = y;
+        found = true;
+        bottom = y + 1;
+        left = min(left, first);
+        right = max(right, last);
+    }
+
+    if (found) {
+        *rect = (GIFRect){ .left = left,
+                           .top = top,
+                           .width = right - left,
+                           .height = bottom - top };
+    }
+    return found;
+}
+
+static void
+animation_flush_pending(GIFAnimation* animation, u8 disposal_method)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    const u16 width = config->metadata.width;
+    const GIFRect rect = animation->pending_rect;
+    const bool mask = config->optimize && config->has_transparent_index &&
+                      !animation->pending_is_key;
+
+    if (!animation->header_written) {
+        /* With local palettes the first one becomes the global colour
+           table, which is only known once the first frame is. */
+        GIFMetadata* screen = &animation->config.metadata;
+        screen->has_gct = true;
+        screen->color_resolution = 7;
+        screen->gct_size_n = animation->pending_palette_size_n;
+        screen->min_code_size = max(screen->gct_size_n + 1, 2);
+        animation->config.color_table = animation->pending_palette;
+        animation_write_header(animation);
+        animation->config.color_table = NULL;
+    }
+
+    size_t y = 0;
+    for (y = 0; y < rect.height; y++) {
+        size_t offset = (rect.top + y) * width + rect.left;
+        u8* out = animation->scratch + y * rect.width;
+        if (mask) {
+            simd_mask_equal(out,
+                            animation->previous + offset,
+                            animation->canvas + offset,
+                            rect.width,
+                            config->transparent_index);
+        } else {
+            memcpy(out, animation->previous + offset, rect.width);
+        }
+    }
+
+    GIFGraphicControl control = {
+        .disposal_method = disposal_method,
+        .user_input_flag = false,
+        .transparent_color_flag = config->has_transparent_index,
+        .delay_time = animation->pending_delay,
+        .transparent_color_index = config->transparent_index,
+    };
+    GIFMetadata metadata = config->metadata;
+    metadata.left = rect.left;
+    metadata.top = rect.top;
+    metadata.width = rect.width;
+    metadata.height = rect.height;
+    metadata.local_color_table = 0;
+    if (animation->pending_palette_id != 0) {
+        metadata.local_color_table =
+          GIF_LOCAL_TABLE_FLAG | animation->pending_palette_size_n;
+        metadata.min_code_size = max(animation->pending_palette_size_n + 1, 2);
+    }
+
+    VArena frame_data;
+    varena_init_ex(&frame_data, GIF_ALLOC_SIZE, system_page_size(), 1);
+    VArena lzw_arena;
+    varena_init(&lzw_arena, LZW_ALLOC_SIZE);
+    Allocator lzw_alloc = varena_allocator(&lzw_arena);
+
+    gif_write_graphics_control_extension(&frame_data, control);
+    gif_write_img_descriptor(&frame_data, &metadata);
+    if (animation->pending_palette_id != 0) {
+        gif_write_local_color_table(&frame_data,
+                                    animation->pending_palette,
+                                    animation->pending_palette_size_n);
+    }
+
+    /* Masked pixels stay transparent, so the transparent index is never
+       swapped. */
+    const bool own_palette = config->palette_mode == GIF_PALETTE_LOCAL ||
+                             animation->pending_palette_id != 0;
+    const LZWLossy lossy = {
+        .color_table =
+          own_palette ? animation->pending_palette : config->color_table,
+        .color_amount = own_palette
+                          ? 1 << (animation->pending_palette_size_n + 1)
+                          : 1 << (config->metadata.gct_size_n + 1),
+        .threshold = animation->pending_lossy,
+        .has_transparent_index = config->has_transparent_index,
+        .transparent_index = config->transparent_index,
+    };
+
+    const LZWInput input = { .indices = animation->scratch,
+                             .length = (size_t)rect.width * rect.height };
+    size_t compressed_len = 0;
+    u8* compressed = gif_compress_lzw(&lzw_alloc,
+                                      config->lzw_hashmap_max_length,
+                                      config->clear_strategy,
+                                      metadata.min_code_size,
+                                      &lossy,
+                                      &input,
+                                      &compressed_len);
+    gif_write_img_data(&frame_data,
+                       metadata.min_code_size,
+                       config->max_block_length,
+                       compressed,
+                       compressed_len);
+    animation_write_arena(animation, &frame_data);
+
+    CLOG_DEBUG("Frame %zu: %hux%hu at (%hu, %hu), disposal %hhu, %zu bytes",
+               animation->frame_count,
+               rect.width,
+               rect.height,
+               rect.left,
+               rect.top,
+               disposal_method,
+               frame_data.used);
+
+    varena_destroy(&frame_data);
+    varena_destroy(&lzw_arena);
+
+    /* Bring the canvas up to date with what is shown after disposal. Outside
+       of the pending rect the canvas already equals the pending frame. */
+    for (y = 0; y < rect.height; y++) {
+        size_t offset = (rect.top + y) * width + rect.left;
+        if (disposal_method == DISPOSAL_BACKGROUND) {
+            memset(
+              animation->canvas + offset, config->transparent_index, rect.width);
+        } else {
+            memcpy(animation->canvas + offset,
+                   animation->previous + offset,
+                   rect.width);
+        }
+    }
+
+    animation->frame_count++;
+    animation->has_pending = false;
+    animation->pending_is_key = false;
+}
+
+static void
+animation_set_palette(GIFAnimation* animation,
+                      const GIFColor* colors,
+                      u8 size_n)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    GIFPaletteMapperOptions options = {
+        .distance = config->quantize.distance,
+        .has_transparent_index = config->has_transparent_index,
+        .transparent_index = config->transparent_index,
+        .alpha_threshold = config->quantize.alpha_threshold,
+        .thread_count = config->quantize.thread_count,
+    };
+    if (animation->mapper)
+        gif_palette_mapper_destroy(animation->mapper);
+    animation->mapper =
+      gif_palette_mapper_create(colors, 1 << (size_n + 1), &options);
+    memcpy(animation->palette, colors, sizeof(GIFColor) << (size_n + 1));
+    animation->palette_size_n = size_n;
+}
+
+GIFAnimation*
+gif_animation_begin(const GIFAnimationConfig* config, const char* out_path)
+{
+    FILE* file = fopen(out_path, "wb");
+    if (file == NULL) {
+        CLOG_ERROR("Could not open %s. Aborting GIF animation\n", out_path);
+        return NULL;
+    }
+
+    GIFAnimation* animation = calloc(1, sizeof(GIFAnimation));
+    animation->config = *config;
+    animation->config.metadata.version = GIF89a;
+    animation->config.metadata.has_graphic_control = true;
+    animation->file = file;
+    animation->pixel_amount =
+      (size_t)config->metadata.width * config->metadata.height;
+    animation->canvas = calloc(animation->pixel_amount, sizeof(u8));
+    animation->previous = calloc(animation->pixel_amount, sizeof(u8));
+    animation->scratch = calloc(animation->pixel_amount, sizeof(u8));
+
+    if (config->palette_mode == GIF_PALETTE_GLOBAL) {
+        animation_write_header(animation);
+    } else if (config->color_table != NULL) {
+        /* The first palette, until another one is set or quantized. */
+        animation_set_palette(
+          animation, config->color_table, config->metadata.gct_size_n);
+    }
+
+    return animation;
+}
+
+void
+gif_animation_add_frame(GIFAnimation* animation,
+                        const u8* indices,
+                        u16 delay_time)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    const u16 width = config->metadata.width;
+    const u16 height = config->metadata.height;
+    const GIFRect screen = { .left = 0, .top = 0, .width = width, .height = height };
+    if (config->palette_mode == GIF_PALETTE_LOCAL &&
+        animation->mapper == NULL) {
+        CLOG_ERROR("Indexed frames of a local palette animation need a "
+                   "palette, see gif_animation_set_palette.");
+        return;
+    }
+
+    u64 hash = 0;
+    if (config->merge_duplicates) {
+        hash = simd_hash(indices, animation->pixel_amount);
+        if (animation->has_pending &&
+            animation->pending_delay + delay_time <= UINT16_MAX &&
+            animation_is_duplicate(animation, indices, hash)) {
+            animation->pending_delay += delay_time;
+            animation->merged_count++;
+            return;
+        }
+    }
+
+    if (animation->has_pending) {
+        u8 disposal_method = DISPOSAL_NONE;
+        GIFRect cleared = { 0 };
+        if (config->has_transparent_index &&
+            animation_cleared_rect(indices,
+                                   animation->previous,
+                                   width,
+                                   height,
+                                   config->transparent_index,
+                                   &cleared)) {
+            animation->pending_rect =
+              rect_union(animation->pending_rect, cleared);
+            disposal_method = DISPOSAL_BACKGROUND;
+        }
+        animation_flush_pending(animation, disposal_method);
+    }
+
+    GIFRect rect = screen;
+    if (animation->frame_count == 0 || animation->palette_changed) {
+        animation->pending_is_key = true;
+    } else if (config->optimize &&
+               !animation_diff_rect(
+                 indices, animation->canvas, width, height, &rect)) {
+        /* Nothing changed, a single pixel keeps the frame timing. */
+        rect = (GIFRect){ .left = 0, .top = 0, .width = 1, .height = 1 };
+    }
+
+    memcpy(animation->previous, indices, animation->pixel_amount);
+    animation->previous_hash = hash;
+    animation->pending_rect = rect;
+    animation->pending_delay = delay_time;
+    animation->pending_lossy = config->lossy;
+    animation->has_pending = true;
+    memcpy(animation->pending_palette,
+           animation->palette,
+           sizeof(GIFColor) << (animation->palette_size_n + 1));
+    animation->pending_palette_size_n = animation->palette_size_n;
+    animation->pending_palette_id = animation->palette_id;
+    animation->palette_changed = false;
+}
+
+/* Mean absolute channel error of mapping every stride-th opaque pixel of rgba
+   through the current palette. */
+static float
+animation_palette_error(GIFAnimation* animation, const u8* rgba)
+{
+    const GIFPaletteMapper* mapper = animation->mapper;
+    size_t stride = quantize_sample_stride(animation->config.sample_stride,
+                                           animation->pixel_amount);
+    u64 error = 0;
+    size_t samples = 0;
+    size_t i = 0;
+    for (i = 0; i < animation->pixel_amount; i += stride) {
+        const u8* pixel = rgba + i * 4;
+        if (pixel[3] < mapper->options.alpha_threshold)
+            continue;
+        u8 index = gif_palette_mapper_map_color(
+          animation->mapper, pixel[0], pixel[1], pixel[2]);
+        const u8* color = mapper->colors[index];
+        error += abs(pixel[0] - color[0]) + abs(pixel[1] - color[1]) +
+                 abs(pixel[2] - color[2]);
+        samples++;
+    }
+    return samples > 0 ? (float)error / (samples * 3) : 0;
+}
+
+/* Keeps the current local palette while it maps rgba about as well as it
+   mapped its own frame, otherwise quantizes rgba into a new one. */
+static void
+animation_select_palette(GIFAnimation* animation, const u8* rgba)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    float threshold = config->palette_error_threshold > 0
+                        ? config->palette_error_threshold
+                        : ANIMATION_DEFAULT_PALETTE_ERROR;
+    if (animation->mapper &&
+        animation_palette_error(animation, rgba) <=
+          animation->mapper_error + threshold) {
+        return;
+    }
+
+    GIFColor palette[256];
+    bool has_transparency = config->has_transparent_index;
+    size_t palette_amount = quantize_palette(&rgba,
+                                             1,
+                                             animation->pixel_amount,
+                                             1,
+                                             &config->quantize,
+                                             palette,
+                                             &has_transparency);
+
+    /* Entries are laid out around the configured transparent index, unused
+       ones repeat the last colour. */
+    size_t color_total = palette_amount + config->has_transparent_index;
+    if (config->has_transparent_index)
+        color_total = max(color_total, (size_t)config->transparent_index + 1);
+    u8 size_n = gif_size_n_for_colors(color_total);
+
+    GIFColor table[256] = { 0 };
+    size_t source = 0;
+    size_t i = 0;
+    for (i = 0; i < (1u << (size_n + 1)) && palette_amount > 0; i++) {
+        if (config->has_transparent_index && i == config->transparent_index)
+            continue;
+        memcpy(table[i],
+               palette[min(source, palette_amount - 1)],
+               sizeof(GIFColor));
+        source++;
+    }
+
+    bool first = animation->frame_count == 0 && !animation->has_pending;
+    animation_set_palette(animation, table, size_n);
+    animation->mapper_error = animation_palette_error(animation, rgba);
+    animation->palette_id = first ? 0 : animation->palette_id + 1;
+    animation->palette_changed = !first;
+    animation->has_rgba_previous = false;
+}
+
+void
+gif_animation_add_frame_rgba(GIFAnimation* animation,
+                             const u8* rgba,
+                             u16 delay_time)
+{
+    const GIFAnimationConfig* config = &animation->config;
+    if (config->palette_mode == GIF_PALETTE_LOCAL) {
+        animation_select_palette(animation, rgba);
+    } else if (animation->mapper == NULL) {
+        if (config->color_table == NULL) {
+            CLOG_ERROR("RGBA frames need a global color table, see "
+                       "gif_quantize_frames.");
+            return;
+        }
+        animation_set_palette(
+          animation, config->color_table, config->metadata.gct_size_n);
+    }
+
+    if (animation->rgba_previous == NULL) {
+        animation->rgba_previous = malloc(animation->pixel_amount * 4);
+        animation->rgba_indices = malloc(animation->pixel_amount);
+        animation->rgba_scratch = malloc(animation->pixel_amount);
+    }
+
+    gif_dither(animation->mapper,
+               rgba,
+               config->metadata.width,
+               config->metadata.height,
+               &config->quantize.dither,
+               animation->rgba_scratch);
+    if (animation->has_rgba_previous) {
+        simd_keep_unchanged(animation->rgba_scratch,
+                            animation->rgba_indices,
+                            rgba,
+                            animation->rgba_previous,
+                            animation->pixel_amount);
+    }
+
+    u8* indices = animation->rgba_scratch;
+    animation->rgba_scratch = animation->rgba_indices;
+    animation->rgba_indices = indices;
+    memcpy(animation->rgba_previous, rgba, animation->pixel_amount * 4);
+    animation->has_rgba_previous = true;
+
+    gif_animation_add_frame(animation, indices, delay_time);
+}
+
+/* Palette of the indices added from now on, written as a local colour table
+   unless it is the first one of a GIF_PALETTE_LOCAL animation. Indexed
+   frames of such an animation need one set before the first frame, or
+   config->color_table to start from. Setting the current palette again
+   changes nothing. */
+void
+gif_animation_set_palette(GIFAnimation* animation,
+                          const GIFColor* colors,
+                          u8 size_n)
+{
+    const bool first = animation->config.palette_mode == GIF_PALETTE_LOCAL &&
+                       animation->frame_count == 0 && !animation->has_pending;
+    if (!first && animation->mapper != NULL &&
+        animation->palette_size_n == size_n &&
+        memcmp(animation->palette, colors, sizeof(GIFColor) << (size_n + 1)) ==
+          0)
+        return;
+
+    animation_set_palette(animation, colors, size_n);
+    animation->mapper_error = 0;
+    animation->palette_id = first ? 0 : animation->palette_id + 1;
+    animation->palette_changed = !first;
+    animation->has_rgba_previous = false;
+}
+
+/* Applies to the frames added from now on. */
+void
+gif_animation_set_lossy(GIFAnimation* animation, u32 lossy)
+{
+    animation->config.lossy = lossy;
+}
+
+void
+gif_animation_end(GIFAnimation* animation)
+{
+    if (animation == NULL)
+        return;
+
+    if (animation->has_pending) {
+        animation_flush_pending(animation, DISPOSAL_NONE);
+    }
+
+    VArena gif_data;
+    varena_init_ex(&gif_data, GIF_ALLOC_SIZE, system_page_size(), 1);
+    gif_write_trailer(&gif_data);
+    animation_write_arena(animation, &gif_data);
+    varena_destroy(&gif_data);
+
+    CLOG_INFO("GIF animation with %zu frames exported (%zu merged, %zu KB).",
+              animation->frame_count,
+              animation->merged_count,
+              animation->bytes_written / KILOBYTE);
+
+    fclose(animation->file);
+    free(animation->canvas);
+    free(animation->previous);
+    free(animation->scratch);
+    free(animation->rgba_previous);
+    free(animation->rgba_indices);
+    free(animation->rgba_scratch);
+    if (animation->mapper)
+        gif_palette_mapper_destroy(animation->mapper);
+    free(animation);
+}
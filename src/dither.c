@@ -0,0 +1,297 @@
+#include <gifbuf/gifbuf.h>
+#include <math.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Pixels between progress updates of the error diffusion wavefront. */
+#define DIFFUSION_CHUNK 32
+
+static const u8 bayer8[8][8] = {
+    { 0, 32, 8, 40, 2, 34, 10, 42 },  { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44, 4, 36, 14, 46, 6, 38 }, { 60, 28, 52, 20, 62, 30, 54, 22 },
+    { 3, 35, 11, 43, 1, 33, 9, 41 },  { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47, 7, 39, 13, 45, 5, 37 }, { 63, 31, 55, 23, 61, 29, 53, 21 },
+};
+
+/* Typical step between neighbouring palette entries: the largest channel
+   difference to the nearest other entry, averaged over the palette. */
+static float
+dither_spread(const GIFPaletteMapper* mapper, float strength)
+{
+    if (mapper->point_amount < 2)
+        return 0;
+
+    float total = 0;
+    size_t i = 0, j = 0;
+    for (i = 0; i < mapper->point_amount; i++) {
+        const u8* a = mapper->colors[mapper->point_indices[i]];
+        int best_distance = INT32_MAX;
+        int best_step = 0;
+        for (j = 0; j < mapper->point_amount; j++) {
+            const u8* b = mapper->colors[mapper->point_indices[j]];
+            int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+            int distance = dr * dr + dg * dg + db * db;
+            if (j == i || distance == 0 || distance >= best_distance)
+                continue;
+            best_distance = distance;
+            best_step = max(max(abs(dr), abs(dg)), abs(db));
+        }
+        total += best_step;
+    }
+    return total / mapper->point_amount * strength;
+}
+
+typedef struct
+{
+    GIFPaletteMapper* mapper;
+    const u8* rgba;
+    u16 width;
+    u8* out_indices;
+    /* Per row of the Bayer matrix, the threshold offsets of 8 pixels split in
+       a positive and a negative part for saturating byte arithmetic. */
+    u8 positive[8][32];
+    u8 negative[8][32];
+} OrderedTask;
+
+static void
+ordered_rows(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    OrderedTask* task = ctx;
+    const size_t width = task->width;
+    u8* row = malloc(width * 4 + 16);
+
+    size_t y = 0;
+    for (y = begin; y < end; y++) {
+        const u8* in = task->rgba + y * width * 4;
+        const u8* positive = task->positive[y & 7];
+        const u8* negative = task->negative[y & 7];
+        size_t x = 0;
+#ifdef __SSE2__
+        for (; x + 4 <= width; x += 4) {
+            size_t offset = (x & 7) * 4;
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(in + x * 4));
+            pixels = _mm_adds_epu8(
+              pixels, _mm_loadu_si128((const __m128i*)(positive + offset)));
+            pixels = _mm_subs_epu8(
+              pixels, _mm_loadu_si128((const __m128i*)(negative + offset)));
+            _mm_storeu_si128((__m128i*)(row + x * 4), pixels);
+        }
+#endif
+        for (; x < width; x++) {
+            size_t offset = (x & 7) * 4;
+            int c = 0;
+            for (c = 0; c < 4; c++) {
+                int value = in[x * 4 + c] + positive[offset + c] -
+                            negative[offset + c];
+                row[x * 4 + c] = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+        }
+        palette_mapper_map_span(
+          task->mapper, row, width, task->out_indices + y * width);
+    }
+    free(row);
+}
+
+static void
+dither_ordered(GIFPaletteMapper* mapper,
+               const u8* rgba,
+               u16 width,
+               u16 height,
+               float strength,
+               u8* out_indices)
+{
+    OrderedTask task = { .mapper = mapper,
+                         .rgba = rgba,
+                         .width = width,
+                         .out_indices = out_indices };
+    const float spread = dither_spread(mapper, strength);
+    int y = 0, x = 0, c = 0;
+    for (y = 0; y < 8; y++) {
+        for (x = 0; x < 8; x++) {
+            float offset = ((bayer8[y][x] + 0.5f) / 64.0f - 0.5f) * spread;
+            u8 magnitude = (u8)fminf(fabsf(offset) + 0.5f, 255.0f);
+            /* Alpha is left untouched. */
+            for (c = 0; c < 3; c++) {
+                task.positive[y][x * 4 + c] = offset > 0 ? magnitude : 0;
+                task.negative[y][x * 4 + c] = offset < 0 ? magnitude : 0;
+            }
+        }
+    }
+
+    gif_parallel_for(
+      height,
+      gif_thread_count_for_pixels((size_t)width * height,
+                                  mapper->options.thread_count),
+      ordered_rows,
+      &task);
+}
+
+typedef struct
+{
+    GIFPaletteMapper* mapper;
+    const u8* rgba;
+    u16 width;
+    u16 height;
+    u8* out_indices;
+    /* Error scale in 1/256 units. */
+    i32 strength;
+    /* Rows are handed out in order, each worker takes the next one. */
+    u32 next_row;
+    /* Pixels finished per row. */
+    u32* progress;
+    /* ring_length rows of carried error, (width + 2) * 3 each, scaled by
+       16. Rows in flight never span more than the worker count, so a ring
+       one longer never has two live rows share a slot. */
+    i32* errors;
+    size_t ring_length;
+} DiffusionTask;
+
+static void
+diffusion_wait(const u32* progress, u32 needed)
+{
+    while (__atomic_load_n(progress, __ATOMIC_ACQUIRE) < needed)
+        sched_yield();
+}
+
+/* Floyd-Steinberg, left to right. Row y may only read the error at pixel x
+   once row y - 1 got past x + 1, so rows run as a wavefront, each worker
+   trailing the one above by a few chunks. */
+static void
+diffusion_rows(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    DiffusionTask* task = ctx;
+    GIFPaletteMapper* mapper = task->mapper;
+    const size_t width = task->width;
+    const size_t stride = (width + 2) * 3;
+    const u8 threshold = mapper->options.alpha_threshold;
+    const bool has_transparent_index = mapper->options.has_transparent_index;
+
+    u32 y = 0;
+    while ((y = __atomic_fetch_add(&task->next_row, 1, __ATOMIC_RELAXED)) <
+           task->height) {
+        /* Offset by one pixel so x - 1 is addressable. */
+        i32* row_error = task->errors + (y % task->ring_length) * stride + 3;
+        i32* next_error =
+          task->errors + ((y + 1) % task->ring_length) * stride + 3;
+        const u8* in = task->rgba + (size_t)y * width * 4;
+        u8* out = task->out_indices + (size_t)y * width;
+        i32 carry[3] = { 0 };
+
+        size_t x = 0;
+        for (x = 0; x < width; x++) {
+            if (x % DIFFUSION_CHUNK == 0) {
+                if (x > 0) {
+                    __atomic_store_n(
+                      &task->progress[y], (u32)x, __ATOMIC_RELEASE);
+                }
+                if (y > 0) {
+                    diffusion_wait(&task->progress[y - 1],
+                                   min(x + DIFFUSION_CHUNK + 1, width));
+                }
+            }
+
+            const u8* pixel = in + x * 4;
+            if (has_transparent_index && pixel[3] < threshold) {
+                out[x] = mapper->options.transparent_index;
+                memset(row_error + x * 3, 0, 3 * sizeof(i32));
+                memset(carry, 0, sizeof(carry));
+                continue;
+            }
+
+            int value[3];
+            int c = 0;
+            for (c = 0; c < 3; c++) {
+                int v = pixel[c] + (row_error[x * 3 + c] + carry[c]) / 16;
+                value[c] = v < 0 ? 0 : v > 255 ? 255 : v;
+                row_error[x * 3 + c] = 0;
+            }
+
+            u8 index = palette_mapper_lookup(
+              mapper, PALETTE_LUT_KEY(value[0], value[1], value[2]));
+            out[x] = index;
+
+            for (c = 0; c < 3; c++) {
+                i32 error =
+                  (value[c] - mapper->colors[index][c]) * task->strength / 256;
+                carry[c] = error * 7;
+                next_error[(x - 1) * 3 + c] += error * 3;
+                next_error[x * 3 + c] += error * 5;
+                next_error[(x + 1) * 3 + c] += error;
+            }
+        }
+        __atomic_store_n(&task->progress[y], (u32)width, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+dither_error_diffusion(GIFPaletteMapper* mapper,
+                       const u8* rgba,
+                       u16 width,
+                       u16 height,
+                       float strength,
+                       u8* out_indices)
+{
+    u8 thread_count = gif_thread_count_for_pixels((size_t)width * height,
+                                                  mapper->options.thread_count);
+    thread_count = max(min(thread_count, height), 1);
+
+    DiffusionTask task = {
+        .mapper = mapper,
+        .rgba = rgba,
+        .width = width,
+        .height = height,
+        .out_indices = out_indices,
+        .strength = (i32)(strength * 256),
+        .progress = calloc(height, sizeof(u32)),
+        .ring_length = thread_count + 1,
+    };
+    task.errors =
+      calloc(task.ring_length * ((size_t)width + 2) * 3, sizeof(i32));
+
+    gif_parallel_for(thread_count, thread_count, diffusion_rows, &task);
+
+    free(task.progress);
+    free(task.errors);
+}
+
+void
+gif_dither(GIFPaletteMapper* mapper,
+           const u8* rgba,
+           u16 width,
+           u16 height,
+           const GIFDitherOptions* options,
+           u8* out_indices)
+{
+    float strength = options->strength > 0 ? fminf(options->strength, 1.0f)
+                                           : 1.0f;
+    if (mapper->point_amount == 0) {
+        memset(out_indices,
+               mapper->options.transparent_index,
+               (size_t)width * height);
+        return;
+    }
+
+    switch (options->method) {
+        case GIF_DITHER_NONE:
+            gif_palette_mapper_map(
+              mapper, rgba, (size_t)width * height, out_indices);
+            break;
+        case GIF_DITHER_ORDERED:
+            dither_ordered(mapper, rgba, width, height, strength, out_indices);
+            break;
+        case GIF_DITHER_ERROR_DIFFUSION:
+            dither_error_diffusion(
+              mapper, rgba, width, height, strength, out_indices);
+            break;
+    }
+}
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <gifbuf/gifbuf.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,30 +8,20 @@
 
 #include "ccore.h"
 #include "clog.h"
-
-#define GIF_ALLOC_SIZE 1 * MEGABYTE
-#define LZW_ALLOC_SIZE 16 * MEGABYTE
+#include "gifbuf_internal.h"
+#include "simd.h"
 
 #define INPUT_BUFFER_CAP 256
 
 #define LZW_DICT_MIN_CAP 2048
 
-#define BIT_ARRAY_MIN_CAP 2 * KILOBYTE
-
-#define LSB_MASK(length) ((1 << (length)) - 1)
-
-typedef struct
-{
-    u8* array;
-    u8 next_byte;
-    u8 current_bit_idx;
-} BitArray;
-
-typedef struct
-{
-    size_t byte_idx;
-    u8 bit_idx;
-} BitArrayReader;
+/* Indices per window the compression ratio is measured over. */
+#define LZW_WINDOW_LENGTH 4096
+#define LZW_ADAPTIVE_TOLERANCE 1.1f
+#define LZW_EARLY_TOLERANCE 2.0f
+/* Codes in use before early clearing kicks in, so that a young dictionary
+   is not thrown away while it is still learning. */
+#define LZW_EARLY_MIN_CODES 2048
 
 void
 bit_array_init(BitArray* bit_array, u8* buffer)
@@ -40,47 +31,6 @@ bit_array_init(BitArray* bit_array, u8* buffer)
     bit_array->next_byte = 0;
 }
 
-#ifndef min
-#define min(a, b)                                                              \
-    ({                                                                         \
-        __typeof__(a) _a = (a);                                                \
-        __typeof__(b) _b = (b);                                                \
-        _a < _b ? _a : _b;                                                     \
-    })
-#endif
-
-/* Return value is always aligned to the least significant bit. */
-u32
-bit_array_read(const u8* bytes, BitArrayReader* reader, u8 bit_amount)
-{
-    assert(reader->bit_idx < 8);
-    assert(bit_amount > 0);
-    u32 result = 0;
-    size_t byte_idx = reader->byte_idx;
-
-    u8 bits_read = 0;
-    u8 bits_in_first_byte = min(8 - reader->bit_idx, bit_amount);
-
-    result |=
-      (bytes[byte_idx] >> reader->bit_idx) & LSB_MASK(bits_in_first_byte);
-    bits_read += bits_in_first_byte;
-    byte_idx++;
-
-    while (bit_amount - bits_read > 8) {
-        result |= bytes[byte_idx] << bits_read;
-        bits_read += 8;
-        byte_idx++;
-    }
-
-    result |= (bytes[byte_idx] & LSB_MASK(bit_amount - bits_read)) << bits_read;
-
-    reader->bit_idx += bit_amount;
-    reader->byte_idx += reader->bit_idx / 8;
-    reader->bit_idx %= 8;
-
-    return result;
-}
-
 void
 bit_array_push(BitArray* bit_array, u16 data, u8 bit_amount)
 {
@@ -138,136 +88,119 @@ lzw_hashmap_reset(Hashmap* hashmap, u16 eoi_code, Allocator* allocator)
     }
 }
 
-void
-gif_decompress_lzw(const u8* compressed,
-                   u8 min_code_size,
-                   u8* out_indices,
-                   Allocator* allocator)
+/* Compressed size of the codes written since window_start, in bits per
+   index. */
+static float
+lzw_window_ratio(const BitArray* bit_array,
+                 size_t window_start_bits,
+                 size_t window_length)
 {
-    const size_t clear_code = 1 << min_code_size;
-    const size_t eoi_code = clear_code + 1;
-    const u8** code_table = array(const u8*, 128, allocator);
-
-    size_t i = 0;
-    for (i = 0; i <= eoi_code; i++) {
-        u8* str = array(u8, 1, allocator);
-        array_append(str, (u8)i);
-        array_append(code_table, str);
-    }
-
-    u8 code_size = min_code_size + 1;
-    BitArrayReader bit_reader = { 0 };
-    /* Read initial clear code */
-    u16 code = bit_array_read(compressed, &bit_reader, code_size);
-
-    int _temp_i = 0;
-
-    CLOG_DEBUG("READ Code[%d]: 0b%0*b (%d)", _temp_i, code_size, code, code);
-    CLOG_DEBUG("Code size: %hhu", code_size);
-    _temp_i++;
-
-    if (code != clear_code) {
-        CLOG_DEBUG("First byte should be the clear code!!");
-    }
-
-    size_t indices_len = 0;
-    /* Initial code after clear (in order to set previous_code) */
-    code = bit_array_read(compressed, &bit_reader, code_size);
-
-    CLOG_DEBUG("READ Code[%d]: 0b%0*b (%d)", _temp_i, code_size, code, code);
-    CLOG_DEBUG("Code size: %hhu", code_size);
-    _temp_i++;
-
-    for (i = 0; i < array_len(code_table[code]); i++) {
-        out_indices[indices_len++] = code_table[code][i];
-    }
-
-    u16 previous_code = code;
-
-    while ((code = bit_array_read(compressed, &bit_reader, code_size)) !=
-           eoi_code) {
+    size_t bits = array_len(bit_array->array) * 8 +
+                  bit_array->current_bit_idx - window_start_bits;
+    return (float)bits / window_length;
+}
 
-        CLOG_DEBUG("~~~~~~~~");
-        CLOG_DEBUG(
-          "READ Code[%d]: 0b%0*b (%d)", _temp_i, code_size, code, code);
-        CLOG_DEBUG("from Byte[%zu]: ", bit_reader.byte_idx);
-        CLOG_DEBUG("    0b%08b (0x%x)",
-                   compressed[bit_reader.byte_idx],
-                   compressed[bit_reader.byte_idx]);
-        for (i = -5; i < 7 - bit_reader.bit_idx; i++)
-            clog_printf_debug(" ");
-        clog_printf_debug("-^\n");
-        CLOG_DEBUG("    Code size: %hhu, Start Bit Index: %d",
-                   code_size,
-                   bit_reader.bit_idx);
-        _temp_i++;
+/* Squared distance with the channel weights of GIF_DISTANCE_WEIGHTED_RGB,
+   scaled so that a grey shift of d scores d * d. */
+u32
+gif_lossy_distance(const GIFColor a, const GIFColor b)
+{
+    i32 dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+    return (2 * dr * dr + 4 * dg * dg + 3 * db * db) / 9;
+}
 
-        if (code == clear_code) {
-            array_header(code_table)->length = eoi_code;
-            code_size = min_code_size + 1;
+/* For every index, the other indices within the lossy threshold, nearest
+   first. candidates holds 256 entries per index. The transparent index is
+   never swapped with anything. */
+static void
+lzw_lossy_candidates(const LZWLossy* lossy, u8* candidates, u16* amounts)
+{
+    const u32 limit = lossy->threshold * lossy->threshold;
+    u32 distances[256];
+    size_t a = 0, b = 0, j = 0;
+    for (a = 0; a < 256; a++) {
+        amounts[a] = 0;
+        if (a >= lossy->color_amount ||
+            (lossy->has_transparent_index && a == lossy->transparent_index))
             continue;
+        u8* list = candidates + a * 256;
+        for (b = 0; b < lossy->color_amount; b++) {
+            if (b == a ||
+                (lossy->has_transparent_index && b == lossy->transparent_index))
+                continue;
+            u32 distance = gif_lossy_distance(lossy->color_table[a],
+                                              lossy->color_table[b]);
+            if (distance > limit)
+                continue;
+            for (j = amounts[a]; j > 0 && distances[j - 1] > distance; j--) {
+                distances[j] = distances[j - 1];
+                list[j] = list[j - 1];
+            }
+            distances[j] = distance;
+            list[j] = b;
+            amounts[a]++;
         }
-
-        if (code_table[previous_code] == NULL) {
-            fprintf(stderr,
-                    "Previous code %d was not in the code table.\n",
-                    previous_code);
-        }
-        assert(code_table[previous_code] != NULL);
-        size_t previous_code_length = array_len(code_table[previous_code]);
-        u8* new_entry = array(u8, previous_code_length + 1, allocator);
-        size_t i = 0;
-        for (i = 0; i < previous_code_length; i++)
-            array_append(new_entry, code_table[previous_code][i]);
-
-        const u8* used_val = NULL;
-        char k = 0;
-
-        if (code < array_len(code_table)) {
-            k = code_table[code][0];
-            used_val = code_table[code];
-        } else {
-            k = code_table[previous_code][0];
-            used_val = new_entry;
-        }
-
-        /* CLOG_DEBUG("k = %x", k); */
-
-        array_append(new_entry, k);
-
-        for (i = 0; i < array_len(used_val); i++) {
-            out_indices[indices_len++] = used_val[i];
-            CLOG_DEBUG("READ: Index[%zu]: %hhu",
-                       indices_len - 1,
-                       out_indices[indices_len - 1]);
-        }
-
-        array_append(code_table, new_entry);
-        if (array_len(code_table) >= (1 << code_size) && code_size < 12) {
-            code_size++;
-        }
-
-        previous_code = code;
     }
+}
 
-    CLOG_DEBUG("Encountered EOI code (%zu) at byte %zu from 0x%02x, completed "
-               "decompression",
-               eoi_code,
-               bit_reader.byte_idx,
-               compressed[bit_reader.byte_idx]);
-    CLOG_DEBUG("Dictionary length was: %zu", array_len(code_table));
+static inline void
+lzw_input_segment(const LZWInput* input,
+                  size_t position,
+                  const u8** segment,
+                  size_t* segment_start,
+                  size_t* segment_end)
+{
+    if (input->rows == NULL && input->packed_bits == 0 &&
+        (input->stride == input->width || input->stride == 0)) {
+        *segment = input->indices;
+        *segment_start = 0;
+        *segment_end = input->length;
+        return;
+    }
+    size_t row = position / input->width;
+    size_t image_row = input->rows != NULL ? input->rows[row] : row;
+    if (input->packed_bits != 0) {
+        simd_unpack_indices(input->row,
+                            input->indices + image_row * input->stride,
+                            input->width,
+                            input->packed_bits);
+        *segment = input->row;
+    } else {
+        *segment = input->indices + image_row * input->stride;
+    }
+    *segment_start = row * input->width;
+    *segment_end = *segment_start + input->width;
 }
 
 u8*
 gif_compress_lzw(Allocator* allocator,
                  size_t lzw_hashmap_max_length,
+                 GIFClearStrategy clear_strategy,
                  u8 min_code_size,
-                 const u8* indices,
-                 size_t indices_len,
+                 const LZWLossy* lossy,
+                 const LZWInput* input,
                  size_t* compressed_len)
 {
+    const size_t indices_len = input->length;
+    /* The input is read one segment at a time, the whole of it or a row
+       when interlaced: stream position i is segment[i - segment_start]. */
+    const u8* segment = NULL;
+    size_t segment_start = 0;
+    size_t segment_end = 0;
+    lzw_input_segment(input, 0, &segment, &segment_start, &segment_end);
+
+    /* Apart from GIF_CLEAR_ON_FULL the dictionary is kept once full, which
+       decoders only follow at the 12 bit limit. */
+    const size_t dictionary_limit = clear_strategy == GIF_CLEAR_ON_FULL
+                                      ? lzw_hashmap_max_length
+                                      : LZW_MAX_CODES;
+    bool dictionary_frozen = false;
+    size_t window_start = 0;
+    size_t window_start_bits = 0;
+    float best_ratio = INFINITY;
+
     Hashmap hashmap = { 0 };
-    hashmap_byte_string_init(&hashmap, lzw_hashmap_max_length, allocator);
+    hashmap_byte_string_init(&hashmap, dictionary_limit, allocator);
     const size_t clear_code = 1 << min_code_size;
     const size_t eoi_code = clear_code + 1;
 
@@ -293,12 +226,47 @@ gif_compress_lzw(Allocator* allocator,
     _temp_i++;
 
     u8* input_buf = array(u8, INPUT_BUFFER_CAP, allocator);
-    array_append(input_buf, indices[0]);
+    array_append(input_buf, segment[0]);
+
+    u8* candidates = NULL;
+    u16 candidate_amounts[256];
+    size_t substitutions = 0;
+    if (lossy != NULL && lossy->threshold > 0 && lossy->color_table != NULL) {
+        candidates = make(u8, 256 * 256, allocator);
+        lzw_lossy_candidates(lossy, candidates, candidate_amounts);
+    }
+
+    /* Runs of a single index are tracked apart from the hashmap: runs[c][l]
+       is the code of l + 1 times c, for every such string in the
+       dictionary. run is the length of input_buf while it is such a
+       string, 0 otherwise. */
+    u16* runs[256] = { NULL };
+    size_t run = 1;
 
     u8* appended = array(u8, INPUT_BUFFER_CAP, allocator);
     size_t i = 0;
     for (i = 1; i < indices_len; i++) {
-        char k = indices[i];
+        if (i == segment_end)
+            lzw_input_segment(
+              input, i, &segment, &segment_start, &segment_end);
+        char k = segment[i - segment_start];
+        const u8 run_index = input_buf[0];
+        if (run > 0 && (u8)k == run_index && runs[run_index] != NULL &&
+            run < array_len(runs[run_index])) {
+            /* Extends the match as far as both the input run and the known
+               run strings go, without a lookup per index. */
+            size_t known = array_len(runs[run_index]) - run;
+            size_t length = simd_run_length(segment + (i - segment_start),
+                                            min(segment_end - i, known),
+                                            run_index);
+            size_t j = 0;
+            for (j = 0; j < length; j++)
+                array_append(input_buf, run_index);
+            run += length;
+            i += length - 1;
+            continue;
+        }
+
         CLOG_DEBUG("Input Buffer (Length=%zu): ", array_len(input_buf));
         if (clog_log_level_get() <= CLOG_LOG_LEVEL_DEBUG)
             clog_print_array_u8(input_buf, array_len(input_buf));
@@ -306,40 +274,104 @@ gif_compress_lzw(Allocator* allocator,
         array_assign(appended, input_buf);
         array_append(appended, k);
 
-        char* result = hashmap_byte_string_get(
-          &hashmap,
-          (ByteString){ .ptr = (char*)appended,
-                        .length = array_len(appended) });
+        /* A run followed by its own index is known to be missing. */
+        const bool known_miss = run > 0 && (u8)k == run_index;
+        char* result =
+          known_miss ? NULL
+                     : hashmap_byte_string_get(
+                         &hashmap,
+                         (ByteString){ .ptr = (char*)appended,
+                                       .length = array_len(appended) });
+
+        if (result == NULL && candidates != NULL) {
+            /* Lossy: the match goes on with the nearest similar colour the
+               dictionary can extend it with. */
+            const u8 original = k;
+            const u8* list = candidates + original * 256;
+            u16 c = 0;
+            for (c = 0; c < candidate_amounts[original] && result == NULL;
+                 c++) {
+                appended[array_len(appended) - 1] = list[c];
+                result = hashmap_byte_string_get(
+                  &hashmap,
+                  (ByteString){ .ptr = (char*)appended,
+                                .length = array_len(appended) });
+                if (result != NULL) {
+                    k = list[c];
+                    substitutions++;
+                }
+            }
+            appended[array_len(appended) - 1] = k;
+        }
 
         if (result != NULL) {
+            run = run > 0 && (u8)k == run_index ? run + 1 : 0;
             array_append(input_buf, k);
             /* CLOG_DEBUG("INPUT: %s", input_buf); */
             continue;
         }
 
-        u16* idx = hashmap_byte_string_get(
-          &hashmap,
-          (ByteString){ .ptr = (char*)input_buf,
-                        .length = array_len(input_buf) });
-
-        if (idx == NULL && clog_log_level_get() <= CLOG_LOG_LEVEL_ERROR) {
-            CLOG_ERROR("Key was not present in hashmap: ");
-            clog_print_array_u8(input_buf, array_len(input_buf));
+        u16 code = 0;
+        if (run > 1) {
+            code = runs[run_index][run - 1];
+        } else {
+            u16* idx = hashmap_byte_string_get(
+              &hashmap,
+              (ByteString){ .ptr = (char*)input_buf,
+                            .length = array_len(input_buf) });
+
+            if (idx == NULL && clog_log_level_get() <= CLOG_LOG_LEVEL_ERROR) {
+                CLOG_ERROR("Key was not present in hashmap: ");
+                clog_print_array_u8(input_buf, array_len(input_buf));
+            }
+            assert(idx != NULL);
+            code = *idx;
         }
-        assert(idx != NULL);
-        assert(*idx < lzw_hashmap_max_length);
+        assert(code < dictionary_limit);
 
-        bit_array_push(&bit_array, *idx, code_size);
+        bit_array_push(&bit_array, code, code_size);
         _temp_i++;
 
+        /* appended extends the run when it is one. */
+        const bool run_extended = known_miss;
         array_header(input_buf)->length = 0;
         array_append(input_buf, k);
+        run = 1;
 
         size_t next_code = hashmap.length + 2;
 
-        /* +2 for CLEAR and EOI codes. */
-        if (next_code >= lzw_hashmap_max_length) {
+        bool clear = false;
+        if (clear_strategy == GIF_CLEAR_ON_FULL) {
+            /* +2 for CLEAR and EOI codes. */
+            clear = next_code >= lzw_hashmap_max_length;
+        } else if (i - window_start >= LZW_WINDOW_LENGTH) {
+            /* Once full the dictionary is kept until the compression ratio
+               over a window drops off the best one seen since the last
+               clear. Clearing early also does this before the dictionary is
+               full, catching content changes it cannot adapt to. */
+            float ratio =
+              lzw_window_ratio(&bit_array, window_start_bits, i - window_start);
+            float tolerance = dictionary_frozen ? LZW_ADAPTIVE_TOLERANCE
+                                                : LZW_EARLY_TOLERANCE;
+            bool watching = dictionary_frozen ||
+                            (clear_strategy == GIF_CLEAR_EARLY &&
+                             next_code >= LZW_EARLY_MIN_CODES);
+            clear = clear_strategy != GIF_CLEAR_DEFERRED && watching &&
+                    ratio > best_ratio * tolerance;
+            best_ratio = min(best_ratio, ratio);
+            window_start = i;
+            window_start_bits =
+              array_len(bit_array.array) * 8 + bit_array.current_bit_idx;
+        }
+
+        if (clear) {
+            /* The decoder has widened its codes once the last entry filled
+               the code size, which only a clear below 4096 codes runs into. */
+            if (next_code >= (1 << code_size) && code_size < 12)
+                code_size++;
             bit_array_push(&bit_array, clear_code, code_size);
+            dictionary_frozen = false;
+            best_ratio = INFINITY;
 
             CLOG_DEBUG("---CLEAR---");
             CLOG_DEBUG("WRITE Code[%d]: 0b%0*zb (%zu)",
@@ -353,8 +385,18 @@ gif_compress_lzw(Allocator* allocator,
             hashmap_clear(&hashmap);
             lzw_hashmap_reset(&hashmap, eoi_code, allocator);
             code_size = min_code_size + 1;
+            size_t c = 0;
+            for (c = 0; c < 256; c++) {
+                if (runs[c] != NULL)
+                    array_header(runs[c])->length = 1;
+            }
+            continue;
+        }
+        if (next_code >= dictionary_limit) {
+            dictionary_frozen = true;
             continue;
-        } else if (next_code >= (1 << code_size)) {
+        }
+        if (next_code >= (1 << code_size)) {
             code_size++;
         }
 
@@ -367,6 +409,13 @@ gif_compress_lzw(Allocator* allocator,
         *val = next_code;
 
         hashmap_insert(&hashmap, key, val);
+        if (run_extended) {
+            if (runs[run_index] == NULL) {
+                runs[run_index] = array(u16, 16, allocator);
+                array_append(runs[run_index], run_index);
+            }
+            array_append(runs[run_index], next_code);
+        }
 
         CLOG_DEBUG("~~~~FOUND~~~~");
         clog_printf_debug("Dict['");
@@ -376,7 +425,7 @@ gif_compress_lzw(Allocator* allocator,
         }
         clog_printf_debug("'] = %d\n", *val);
         CLOG_DEBUG(
-          "WRITE Code[%d]: 0b%0*b (%d)", _temp_i, code_size, *idx, *idx);
+          "WRITE Code[%d]: 0b%0*b (%d)", _temp_i, code_size, code, code);
         CLOG_DEBUG("to Byte[%zu]: ", array_len(bit_array.array) - 1);
         clog_printf_debug(
           "    0b%08b (0x%x)\n", bit_array.next_byte, bit_array.next_byte);
@@ -414,6 +463,8 @@ gif_compress_lzw(Allocator* allocator,
     bit_array_pad_last_byte(&bit_array);
     *compressed_len = array_len(bit_array.array);
     CLOG_DEBUG("Dictionary length: %zu", hashmap.length);
+    if (candidates != NULL)
+        CLOG_DEBUG("Lossy substitutions: %zu", substitutions);
 
     /* CLOG_DEBUG("0x%x", bit_array.array[5608 - 73 - 22]); */
 
@@ -493,13 +544,9 @@ gif_write_logical_screen_descriptor(VArena* gif_data,
 size_t
 gif_read_global_color_table(const u8* bytes, u8 N, GIFColor* colors)
 {
-    u16 color_amount = 1 << (N + 1);
-    size_t i = 0;
-    for (i = 0; i < color_amount; i++) {
-        memcpy(colors[i], bytes + i * sizeof(GIFColor), sizeof(GIFColor));
-    }
-
-    return color_amount * sizeof(GIFColor);
+    size_t size = sizeof(GIFColor) << (N + 1);
+    memcpy(colors, bytes, size);
+    return size;
 }
 
 void
@@ -513,6 +560,35 @@ gif_write_global_color_table(VArena* gif_data, const GIFColor* colors)
     }
 }
 
+void
+gif_write_local_color_table(VArena* gif_data, const GIFColor* colors, u8 N)
+{
+    size_t color_amount = 1 << (N + 1);
+    varena_push_copy(gif_data, colors, color_amount * sizeof(GIFColor));
+}
+
+/* NETSCAPE2.0 application extension, loop_count of 0 loops forever. */
+void
+gif_write_loop_extension(VArena* gif_data, u16 loop_count)
+{
+    const u8 introducer = 0x21;
+    const u8 application_label = 0xff;
+    const u8 block_size = 0x0b;
+    varena_push_copy(gif_data, &introducer, sizeof(u8));
+    varena_push_copy(gif_data, &application_label, sizeof(u8));
+    varena_push_copy(gif_data, &block_size, sizeof(u8));
+    varena_push_copy(gif_data, "NETSCAPE2.0", block_size);
+
+    const u8 sub_block_size = 0x03;
+    const u8 sub_block_id = 0x01;
+    varena_push_copy(gif_data, &sub_block_size, sizeof(u8));
+    varena_push_copy(gif_data, &sub_block_id, sizeof(u8));
+    varena_push_copy(gif_data, &loop_count, sizeof(u16));
+
+    const u8 terminator = 0x00;
+    varena_push_copy(gif_data, &terminator, sizeof(u8));
+}
+
 size_t
 gif_read_graphic_control_extension(const u8* bytes, GIFGraphicControl* output)
 {
@@ -545,7 +621,7 @@ gif_read_graphic_control_extension(const u8* bytes, GIFGraphicControl* output)
     u8 packed = bytes[cursor];
     cursor += sizeof(u8);
 
-    output->disposal_method = (packed >> 3) & LSB_MASK(3);
+    output->disposal_method = (packed >> 2) & LSB_MASK(3);
     output->user_input_flag = (packed >> 1) & LSB_MASK(1);
     output->transparent_color_flag = packed & LSB_MASK(1);
 
@@ -585,7 +661,7 @@ gif_write_graphics_control_extension(VArena* gif_data,
     varena_push_copy(gif_data, &block_size, sizeof(u8));
 
     u8 packed = 0;
-    packed |= (control.disposal_method & LSB_MASK(3)) << 3;
+    packed |= (control.disposal_method & LSB_MASK(3)) << 2;
     packed |= (control.user_input_flag & LSB_MASK(1)) << 1;
     packed |= (control.transparent_color_flag & LSB_MASK(1));
     varena_push_copy(gif_data, &packed, sizeof(u8));
@@ -636,13 +712,31 @@ gif_write_img_descriptor(VArena* gif_data, const GIFMetadata* metadata)
     varena_push_copy(gif_data, &metadata->local_color_table, sizeof(u8));
 }
 
-/* Reads the data blocks and writes all bytes to a continous buffer. */
+/* Bytes in the data blocks of the image data at in_bytes, which starts with
+   the minimum code size. */
+static size_t
+gif_img_data_length(const u8* in_bytes)
+{
+    size_t read_cursor = 1;
+    size_t length = 0;
+    while (in_bytes[read_cursor] > 0) {
+        length += in_bytes[read_cursor];
+        read_cursor += in_bytes[read_cursor] + 1;
+    }
+    return length;
+}
+
+/* Reads the data blocks and writes all bytes to a continous buffer, their
+   amount to out_length. */
 size_t
-gif_read_img_data(const u8* in_bytes, u8* lzw_min_code, u8* out_bytes)
+gif_read_img_data(const u8* in_bytes,
+                  u8* lzw_min_code,
+                  u8* out_bytes,
+                  size_t* out_length)
 {
     size_t read_cursor = 0;
     size_t write_cursor = 0;
-    memcpy(&lzw_min_code, in_bytes + read_cursor, sizeof(u8));
+    memcpy(lzw_min_code, in_bytes + read_cursor, sizeof(u8));
     read_cursor += sizeof(u8);
 
     u8 block_length = 0;
@@ -663,6 +757,7 @@ gif_read_img_data(const u8* in_bytes, u8* lzw_min_code, u8* out_bytes)
       "block lengths)",
       write_cursor);
 
+    *out_length = write_cursor;
     return read_cursor;
 }
 
@@ -711,8 +806,150 @@ gif_write_trailer(VArena* gif_data)
     varena_push_copy(gif_data, &trailer, 1);
 }
 
+/* First row and row step of each interlace pass. */
+static const u8 interlace_starts[GIF_INTERLACE_PASSES] = { 0, 4, 2, 1 };
+static const u8 interlace_steps[GIF_INTERLACE_PASSES] = { 8, 8, 4, 2 };
+
+/* Image row of every stream row of an interlaced image, and the amount of
+   rows in the stream after each pass. */
 void
-gif_import(const u8* file_data, GIFObject* gif_object)
+gif_interlace_rows(u16 height,
+                   u16* rows,
+                   u16 pass_rows[GIF_INTERLACE_PASSES])
+{
+    u16 count = 0;
+    u8 pass = 0;
+    for (pass = 0; pass < GIF_INTERLACE_PASSES; pass++) {
+        u32 row = 0;
+        for (row = interlace_starts[pass]; row < height;
+             row += interlace_steps[pass])
+            rows[count++] = row;
+        pass_rows[pass] = count;
+    }
+}
+
+typedef struct
+{
+    const GIFObject* gif_object;
+    const GIFImportOptions* options;
+    u8 pass_count;
+    /* Rows of the image as stored, for decoding in row mode. */
+    const u16* rows;
+    u16 width;
+    u16 height;
+    GIFRect region;
+    u8 downscale;
+    u32 rows_left;
+    /* Where the kept rows go, as indices or through palette. */
+    u8* pixels;
+    size_t stride;
+    GIFPixelFormat format;
+    u8 index_bits;
+    u8 palette[256][4];
+    u8* scratch;
+} ImportState;
+
+static void
+import_on_pass(void* ctx, u8 pass)
+{
+    ImportState* state = ctx;
+    state->options->progress(
+      state->gif_object, pass, state->pass_count, state->options->user_data);
+}
+
+/* Index of the pixel a downscaled pixel takes, the middle one of its block
+   or the last one for a block cut off by the edge. */
+static inline u32
+import_sample(u32 position, u8 downscale, u16 size)
+{
+    return min(position * downscale + downscale / 2, (u32)size - 1);
+}
+
+/* Keeps the rows of the region, or the ones a downscaled region samples
+   with every downscale-th index of them. Stops the decode once the last
+   one is in. */
+static bool
+import_on_row(void* ctx, u32 row, const u8* indices)
+{
+    ImportState* state = ctx;
+    const GIFMetadata* metadata = &state->gif_object->metadata;
+    const GIFRect region = state->region;
+    const u32 image_y = state->rows != NULL ? state->rows[row] : row;
+    if (image_y < region.top || image_y >= region.top + region.height)
+        return true;
+    const u32 y = image_y - region.top;
+    const u32 out_y = y / state->downscale;
+    if (import_sample(out_y, state->downscale, region.height) != y)
+        return true;
+
+    u8* out = state->pixels + out_y * state->stride;
+    const u16 width = metadata->width;
+    indices += region.left;
+    if (state->downscale > 1) {
+        u8* sampled = state->format == GIF_PIXEL_INDEX ? out : state->scratch;
+        u32 x = 0;
+        for (x = 0; x < width; x++)
+            sampled[x] =
+              indices[import_sample(x, state->downscale, region.width)];
+        indices = sampled;
+    }
+
+    if (state->index_bits == 8) {
+        if (indices != out)
+            memcpy(out, indices, width);
+    } else if (state->index_bits != 0) {
+        simd_pack_indices(out, indices, width, state->index_bits);
+    } else {
+        u32 x = 0;
+        for (x = 0; x < width; x++)
+            memcpy(out + x * 4, state->palette[indices[x]], 4);
+    }
+    return --state->rows_left > 0;
+}
+
+/* Colours of the palette in the byte order of format, the transparent one
+   with alpha 0. */
+static void
+import_palette(ImportState* state,
+               const GIFObject* gif_object,
+               const GIFGraphicControl* control)
+{
+    const u16 amount = 1 << (gif_object->metadata.gct_size_n + 1);
+    memset(state->palette, 0, sizeof(state->palette));
+    u16 i = 0;
+    for (i = 0; i < amount && gif_object->color_table != NULL; i++) {
+        const u8* color = gif_object->color_table[i];
+        u8* entry = state->palette[i];
+        entry[0] = state->format == GIF_PIXEL_BGRA ? color[2] : color[0];
+        entry[1] = color[1];
+        entry[2] = state->format == GIF_PIXEL_BGRA ? color[0] : color[2];
+        entry[3] = control->transparent_color_flag &&
+                       i == control->transparent_color_index
+                     ? 0
+                     : 255;
+    }
+}
+
+/* Points colors at the table in bytes when borrowed, at a copy otherwise.
+   Returns the size of the table. */
+static size_t
+import_color_table(const u8* bytes, u8 size_n, bool borrow, GIFColor** colors)
+{
+    if (borrow) {
+        *colors = (GIFColor*)bytes;
+        return sizeof(GIFColor) << (size_n + 1);
+    }
+    *colors = malloc(sizeof(GIFColor) << (size_n + 1));
+    return gif_read_global_color_table(bytes, size_n, *colors);
+}
+
+/* Decodes the first image of file_data into buffer, or into newly
+   allocated indices without one. */
+static void
+import_image(const u8* file_data,
+             const GIFImportOptions* options,
+             const GIFPixelBuffer* buffer,
+             GIFObject* gif_object)
 {
     if (file_data == NULL) {
         CLOG_ERROR("File data was NULL. Aborting GIF import\n");
@@ -729,54 +966,517 @@ gif_import(const u8* file_data, GIFObject* gif_object)
     cursor += gif_read_logical_screen_descriptor(file_data + cursor,
                                                  &gif_object->metadata);
     gif_object->metadata.min_code_size = gif_object->metadata.gct_size_n + 1;
-    gif_object->color_table =
-      calloc((1 << (gif_object->metadata.gct_size_n + 1)), sizeof(GIFColor));
-    cursor += gif_read_global_color_table(file_data + cursor,
-                                          gif_object->metadata.gct_size_n,
-                                          gif_object->color_table);
+    const bool borrow = options != NULL && options->borrow_color_table;
+    if (gif_object->metadata.has_gct) {
+        cursor += import_color_table(file_data + cursor,
+                                     gif_object->metadata.gct_size_n,
+                                     borrow,
+                                     &gif_object->color_table);
+    } else {
+        gif_object->color_table =
+          borrow ? NULL
+                 : calloc(1 << (gif_object->metadata.gct_size_n + 1),
+                          sizeof(GIFColor));
+    }
 
+    GIFGraphicControl graphic_control = { 0 };
     if (file_data[cursor] == '!') {
-        GIFGraphicControl graphic_control = { 0 };
         cursor += gif_read_graphic_control_extension(file_data + cursor,
                                                      &graphic_control);
     }
 
     cursor +=
       gif_read_img_descriptor(file_data + cursor, &gif_object->metadata);
+    if (gif_object->metadata.local_color_table & GIF_LOCAL_TABLE_FLAG) {
+        /* The indices refer to the local table, which takes the place of
+           the global one. */
+        if (!borrow)
+            free(gif_object->color_table);
+        gif_object->metadata.gct_size_n =
+          gif_object->metadata.local_color_table & LSB_MASK(3);
+        cursor += import_color_table(file_data + cursor,
+                                     gif_object->metadata.gct_size_n,
+                                     borrow,
+                                     &gif_object->color_table);
+    }
 
     size_t pixel_amount =
       gif_object->metadata.width * gif_object->metadata.height;
 
-    u8* compressed = array(u8, pixel_amount, &lzw_alloc);
-    gif_read_img_data(
-      file_data + cursor, &gif_object->metadata.min_code_size, compressed);
+    /* LZW data can be longer than the indices it codes, so the buffer is
+       sized from the blocks. */
+    u8* compressed =
+      array(u8, max(gif_img_data_length(file_data + cursor), 1), &lzw_alloc);
+    size_t compressed_len = 0;
+    gif_read_img_data(file_data + cursor,
+                      &gif_object->metadata.min_code_size,
+                      compressed,
+                      &compressed_len);
+
+    ImportState state = { .gif_object = gif_object,
+                          .options = options,
+                          .pass_count = 1,
+                          .width = gif_object->metadata.width,
+                          .height = gif_object->metadata.height,
+                          .downscale = 1,
+                          .format = GIF_PIXEL_INDEX,
+                          .index_bits = 8 };
+    LZWOutput output = { .length = pixel_amount,
+                         .width = state.width,
+                         .ctx = &state };
+    u16 pass_rows[GIF_INTERLACE_PASSES] = { state.height };
+    if (gif_object->metadata.local_color_table & GIF_INTERLACE_FLAG) {
+        u16* rows = array(u16, state.height, &lzw_alloc);
+        gif_interlace_rows(state.height, rows, pass_rows);
+        output.rows = rows;
+        state.rows = rows;
+        state.pass_count = GIF_INTERLACE_PASSES;
+    }
+
+    state.region = (GIFRect){ .width = state.width, .height = state.height };
+    if (options != NULL && options->region.width > 0 &&
+        options->region.height > 0) {
+        const GIFRect region = options->region;
+        state.region.left = min(region.left, state.width);
+        state.region.top = min(region.top, state.height);
+        state.region.width = min(region.width, state.width - state.region.left);
+        state.region.height =
+          min(region.height, state.height - state.region.top);
+        if (state.region.width == 0 || state.region.height == 0)
+            CLOG_ERROR("Region %hux%hu at (%hu, %hu) is outside the image.",
+                       region.width,
+                       region.height,
+                       region.left,
+                       region.top);
+    }
+    const bool cropped = state.region.width != state.width ||
+                         state.region.height != state.height;
+
+    if (options != NULL && options->downscale > 1)
+        state.downscale = options->downscale;
+    gif_object->metadata.left += state.region.left;
+    gif_object->metadata.top += state.region.top;
+    gif_object->metadata.width =
+      (state.region.width + state.downscale - 1) / state.downscale;
+    gif_object->metadata.height =
+      (state.region.height + state.downscale - 1) / state.downscale;
+    state.rows_left = gif_object->metadata.height;
+
+    gif_object->stride = 0;
+    if (buffer != NULL) {
+        state.pixels = buffer->pixels;
+        state.stride = buffer->stride;
+        state.format = buffer->format;
+        state.index_bits = gif_index_bits(buffer->format);
+        gif_object->indices = NULL;
+        if (state.index_bits != 0 &&
+            gif_object->metadata.gct_size_n + 1 > state.index_bits) {
+            CLOG_ERROR("A palette of %d colors does not fit %hhu bit indices.",
+                       1 << (gif_object->metadata.gct_size_n + 1),
+                       state.index_bits);
+            state.rows_left = 0;
+        }
+    } else {
+        gif_object->indices = calloc(
+          (size_t)gif_object->metadata.width * gif_object->metadata.height,
+          sizeof(u8));
+        state.pixels = gif_object->indices;
+        state.stride = gif_object->metadata.width;
+    }
+
+    /* Whole images of dense indices are decoded in place, anything else a
+       row at a time, so that only the kept indices are ever stored. */
+    if (cropped || state.downscale > 1 || state.format != GIF_PIXEL_INDEX ||
+        state.stride != state.width) {
+        output.on_row = import_on_row;
+        if (state.format != GIF_PIXEL_INDEX) {
+            import_palette(&state, gif_object, &graphic_control);
+            state.scratch = array(u8, gif_object->metadata.width, &lzw_alloc);
+        }
+    } else {
+        output.indices = state.pixels;
+    }
 
-    gif_object->indices = calloc(pixel_amount, sizeof(u8));
-    gif_decompress_lzw(compressed,
-                       gif_object->metadata.min_code_size,
-                       gif_object->indices,
-                       &lzw_alloc);
+    if (options != NULL && options->progress != NULL) {
+        u8 pass = 0;
+        for (pass = 0; pass < state.pass_count; pass++)
+            output.pass_ends[pass] = (size_t)pass_rows[pass] * state.width;
+        output.pass_count = state.pass_count;
+        output.on_pass = import_on_pass;
+    }
+
+    if (output.on_row == NULL || state.rows_left > 0)
+        gif_decompress_lzw(compressed,
+                           compressed_len,
+                           gif_object->metadata.min_code_size,
+                           &output);
     varena_destroy(&lzw_arena);
 }
 
+void
+gif_import(const u8* file_data, GIFObject* gif_object)
+{
+    import_image(file_data, NULL, NULL, gif_object);
+}
+
+void
+gif_import_ex(const u8* file_data,
+              const GIFImportOptions* options,
+              GIFObject* gif_object)
+{
+    import_image(file_data, options, NULL, gif_object);
+}
+
+void
+gif_import_into(const u8* file_data,
+                const GIFImportOptions* options,
+                const GIFPixelBuffer* buffer,
+                GIFObject* gif_object)
+{
+    import_image(file_data, options, buffer, gif_object);
+}
+
 void
 gif_export(GIFObject gif_object,
            size_t lzw_hashmap_max_length,
            size_t max_block_length,
            const char* out_path)
 {
+    GIFExportOptions options = { .lzw_hashmap_max_length =
+                                   lzw_hashmap_max_length,
+                                 .max_block_length = max_block_length };
+    gif_export_ex(gif_object, &options, out_path);
+}
+
+static size_t
+export_measure(const GIFExportOptions* options,
+               GIFClearStrategy clear_strategy,
+               u8 min_code_size,
+               const LZWLossy* lossy,
+               const LZWInput* input)
+{
+    VArena lzw_arena;
+    varena_init(&lzw_arena, LZW_ALLOC_SIZE);
+    Allocator lzw_alloc = varena_allocator(&lzw_arena);
+    size_t compressed_len = 0;
+    gif_compress_lzw(&lzw_alloc,
+                     options->lzw_hashmap_max_length,
+                     clear_strategy,
+                     min_code_size,
+                     lossy,
+                     input,
+                     &compressed_len);
+    varena_destroy(&lzw_arena);
+    return compressed_len;
+}
+
+static size_t
+export_stride(const GIFObject* gif_object, GIFPixelFormat index_format)
+{
+    return gif_object->stride != 0
+             ? gif_object->stride
+             : gif_row_bytes(gif_object->metadata.width, index_format);
+}
+
+/* row has room for a row of indices when they are packed. */
+static LZWInput
+export_input(const GIFObject* gif_object,
+             const u16* rows,
+             GIFPixelFormat index_format,
+             u8* row)
+{
+    const u8 bits = gif_index_bits(index_format);
+    return (LZWInput){ .indices = gif_object->indices,
+                       .length = (size_t)gif_object->metadata.width *
+                                 gif_object->metadata.height,
+                       .width = gif_object->metadata.width,
+                       .rows = rows,
+                       .stride = export_stride(gif_object, index_format),
+                       .packed_bits = bits < 8 ? bits : 0,
+                       .row = row };
+}
+
+/* Builds the order of the first amount palette entries. Returns false for
+   GIF_PALETTE_ORDER_NONE. */
+static bool
+export_palette_order(GIFPaletteOrder palette_order,
+                     const GIFColor* colors,
+                     const u32* counts,
+                     u16 amount,
+                     u8* order)
+{
+    switch (palette_order) {
+        case GIF_PALETTE_ORDER_NONE:
+            return false;
+        case GIF_PALETTE_ORDER_FREQUENCY:
+            palette_order_frequency(counts, amount, order);
+            return true;
+        case GIF_PALETTE_ORDER_CHAIN:
+            palette_order_chain(colors, counts, amount, order);
+            return true;
+    }
+    return false;
+}
+
+/* Rewrites colors and indices of gif_object into out_colors and out_indices
+   following order, where order[new] = old. */
+static void
+export_apply_order(const GIFObject* gif_object,
+                   const u8* order,
+                   u16 amount,
+                   size_t pixel_amount,
+                   GIFColor* out_colors,
+                   u8* out_indices,
+                   u8* out_transparent_index)
+{
+    u8 remap[256] = { 0 };
+    size_t i = 0;
+    for (i = 0; i < amount; i++) {
+        memcpy(out_colors[i], gif_object->color_table[order[i]], sizeof(GIFColor));
+        remap[order[i]] = i;
+    }
+    index_remap(out_indices, gif_object->indices, pixel_amount, remap);
+    *out_transparent_index =
+      remap[gif_object->graphic_control.transparent_color_index];
+}
+
+GIFExportStats
+gif_export_ex(GIFObject gif_object,
+              const GIFExportOptions* options,
+              const char* out_path)
+{
+    GIFExportStats stats = { 0 };
+    const size_t pixel_amount =
+      (size_t)gif_object.metadata.width * gif_object.metadata.height;
+    const bool reorder = options->palette_order != GIF_PALETTE_ORDER_NONE ||
+                         options->effort == GIF_EFFORT_MAX;
+    GIFPixelFormat index_format = options->index_format;
+    if (gif_index_bits(index_format) == 0) {
+        CLOG_ERROR("Pixel format %d does not hold indices.", index_format);
+        return stats;
+    }
+
+    /* Packed or strided indices are read a row at a time as they are
+       encoded, unless the palette work needs them all in one block. */
+    const size_t stride = export_stride(&gif_object, index_format);
+    u8* dense = NULL;
+    if ((index_format != GIF_PIXEL_INDEX ||
+         stride != gif_object.metadata.width) &&
+        (options->minimize_palette || reorder)) {
+        dense = malloc(pixel_amount > 0 ? pixel_amount : 1);
+        size_t y = 0;
+        for (y = 0; y < gif_object.metadata.height; y++) {
+            gif_unpack_indices(gif_object.indices + y * stride,
+                               gif_object.metadata.width,
+                               index_format,
+                               dense + y * gif_object.metadata.width);
+        }
+        gif_object.indices = dense;
+        gif_object.stride = 0;
+        index_format = GIF_PIXEL_INDEX;
+    }
+    u8* packed_row = malloc(max(gif_object.metadata.width, 1));
+
+    /* The rows are encoded in pass order, an interlaced import stays
+       interlaced. */
+    u16* rows = NULL;
+    if (options->interlace ||
+        (gif_object.metadata.local_color_table & GIF_INTERLACE_FLAG)) {
+        u16 pass_rows[GIF_INTERLACE_PASSES];
+        rows = malloc(max(gif_object.metadata.height, 1) * sizeof(u16));
+        gif_interlace_rows(gif_object.metadata.height, rows, pass_rows);
+        gif_object.metadata.local_color_table |= GIF_INTERLACE_FLAG;
+    }
+
+    u32 counts[256];
+    if (options->minimize_palette || reorder)
+        index_histogram(gif_object.indices, pixel_amount, counts);
+
+    GIFColor color_table[256] = { { 0 } };
+    u8* remapped = NULL;
+    if (options->minimize_palette) {
+        u8 remap[256];
+        u16 used =
+          palette_minimize(&gif_object, counts, color_table, remap);
+        remapped = malloc(pixel_amount > 0 ? pixel_amount : 1);
+        index_remap(remapped, gif_object.indices, pixel_amount, remap);
+
+        u32 remapped_counts[256] = { 0 };
+        size_t i = 0;
+        for (i = 0; i < 256; i++)
+            remapped_counts[remap[i]] += counts[i];
+        memcpy(counts, remapped_counts, sizeof(counts));
+
+        u8 gct_size_n = gif_size_n_for_colors(used);
+        CLOG_DEBUG("Palette minimized from %d to %hu colors, gct_size_n %hhu "
+                   "-> %hhu.",
+                   1 << (gif_object.metadata.gct_size_n + 1),
+                   used,
+                   gif_object.metadata.gct_size_n,
+                   gct_size_n);
+        gif_object.metadata.gct_size_n = gct_size_n;
+        gif_object.metadata.min_code_size = max(gct_size_n + 1, 2);
+        gif_object.graphic_control.transparent_color_index =
+          remap[gif_object.graphic_control.transparent_color_index];
+        gif_object.color_table = color_table;
+        gif_object.indices = remapped;
+    }
+
+    if (reorder) {
+        const u16 amount = 1 << (gif_object.metadata.gct_size_n + 1);
+        GIFPaletteOrder chosen = options->palette_order;
+        if (options->effort == GIF_EFFORT_MAX && options->lossy > 0) {
+            /* Lossless LZW codes any relabelling of the indices to the same
+               length, so only the lossy matches an order steers are worth
+               measuring. Every order is encoded and the smallest kept. */
+            const GIFPaletteOrder candidates[] = { GIF_PALETTE_ORDER_FREQUENCY,
+                                                   GIF_PALETTE_ORDER_CHAIN };
+            const LZWInput input =
+              export_input(&gif_object, rows, index_format, packed_row);
+            LZWLossy lossy = {
+                .color_table = gif_object.color_table,
+                .color_amount = amount,
+                .threshold = options->lossy,
+                .has_transparent_index =
+                  gif_object.metadata.has_graphic_control &&
+                  gif_object.graphic_control.transparent_color_flag,
+                .transparent_index =
+                  gif_object.graphic_control.transparent_color_index,
+            };
+            size_t baseline = export_measure(options,
+                                             options->clear_strategy,
+                                             gif_object.metadata.min_code_size,
+                                             &lossy,
+                                             &input);
+            size_t best = baseline;
+            u8* candidate_indices = malloc(pixel_amount > 0 ? pixel_amount : 1);
+            LZWInput candidate_input = input;
+            candidate_input.indices = candidate_indices;
+            chosen = GIF_PALETTE_ORDER_NONE;
+            size_t c = 0;
+            for (c = 0; c < sizeof(candidates) / sizeof(candidates[0]); c++) {
+                u8 order[256];
+                GIFColor colors[256];
+                u8 transparent_index = 0;
+                export_palette_order(candidates[c],
+                                     gif_object.color_table,
+                                     counts,
+                                     amount,
+                                     order);
+                export_apply_order(&gif_object,
+                                   order,
+                                   amount,
+                                   pixel_amount,
+                                   colors,
+                                   candidate_indices,
+                                   &transparent_index);
+                lossy.color_table = colors;
+                lossy.transparent_index = transparent_index;
+                size_t length = export_measure(options,
+                                               options->clear_strategy,
+                                               gif_object.metadata.min_code_size,
+                                               &lossy,
+                                               &candidate_input);
+                if (length < best) {
+                    best = length;
+                    chosen = candidates[c];
+                }
+            }
+            free(candidate_indices);
+            stats.palette_order_delta = (ptrdiff_t)best - (ptrdiff_t)baseline;
+            CLOG_INFO("Palette order %d changes the image data by %td bytes "
+                      "(%zu -> %zu).",
+                      chosen,
+                      stats.palette_order_delta,
+                      baseline,
+                      best);
+        }
+
+        u8 order[256];
+        if (export_palette_order(
+              chosen, gif_object.color_table, counts, amount, order)) {
+            GIFColor colors[256];
+            u8* indices = malloc(pixel_amount > 0 ? pixel_amount : 1);
+            export_apply_order(&gif_object,
+                               order,
+                               amount,
+                               pixel_amount,
+                               colors,
+                               indices,
+                               &gif_object.graphic_control
+                                  .transparent_color_index);
+            memcpy(color_table, colors, amount * sizeof(GIFColor));
+            gif_object.color_table = color_table;
+            gif_object.indices = indices;
+            free(remapped);
+            remapped = indices;
+            /* The sort flag marks a table in decreasing order of use. */
+            gif_object.metadata.sort = chosen == GIF_PALETTE_ORDER_FREQUENCY;
+        }
+    }
+
+    const LZWLossy lossy = {
+        .color_table = gif_object.color_table,
+        .color_amount = 1 << (gif_object.metadata.gct_size_n + 1),
+        .threshold = options->lossy,
+        .has_transparent_index = gif_object.metadata.has_graphic_control &&
+                                 gif_object.graphic_control.transparent_color_flag,
+        .transparent_index = gif_object.graphic_control.transparent_color_index,
+    };
+
+    const LZWInput input =
+      export_input(&gif_object, rows, index_format, packed_row);
+    GIFClearStrategy clear_strategy = options->clear_strategy;
+    if (options->effort == GIF_EFFORT_MAX) {
+        size_t best = SIZE_MAX;
+        GIFClearStrategy candidate = GIF_CLEAR_ON_FULL;
+        for (candidate = GIF_CLEAR_ON_FULL; candidate <= GIF_CLEAR_EARLY;
+             candidate++) {
+            size_t length = export_measure(options,
+                                           candidate,
+                                           gif_object.metadata.min_code_size,
+                                           &lossy,
+                                           &input);
+            if (length < best) {
+                best = length;
+                clear_strategy = candidate;
+            }
+        }
+    }
+    stats.clear_strategy = clear_strategy;
+
     VArena gif_data;
     varena_init_ex(&gif_data, GIF_ALLOC_SIZE, system_page_size(), 1);
 
+    /* An image with a local colour table is written without a global one,
+       its table sized by gct_size_n as it is on import. */
+    const bool local =
+      gif_object.metadata.local_color_table & GIF_LOCAL_TABLE_FLAG;
+    if (local) {
+        gif_object.metadata.local_color_table =
+          GIF_LOCAL_TABLE_FLAG |
+          (gif_object.metadata.local_color_table & GIF_INTERLACE_FLAG) |
+          (gif_object.metadata.sort ? GIF_LOCAL_SORT_FLAG : 0) |
+          gif_object.metadata.gct_size_n;
+        gif_object.metadata.has_gct = false;
+        gif_object.metadata.sort = false;
+    }
+
     gif_write_header(&gif_data, gif_object.metadata.version);
     gif_write_logical_screen_descriptor(&gif_data, &gif_object.metadata);
 
-    gif_write_global_color_table(&gif_data, gif_object.color_table);
+    if (!local)
+        gif_write_global_color_table(&gif_data, gif_object.color_table);
     if (gif_object.metadata.has_graphic_control) {
         gif_write_graphics_control_extension(&gif_data,
                                              gif_object.graphic_control);
     }
     gif_write_img_descriptor(&gif_data, &gif_object.metadata);
+    if (local) {
+        gif_write_local_color_table(&gif_data,
+                                    gif_object.color_table,
+                                    gif_object.metadata.gct_size_n);
+    }
 
     VArena lzw_arena;
     varena_init(&lzw_arena, LZW_ALLOC_SIZE);
@@ -786,15 +1486,34 @@ gif_export(GIFObject gif_object,
     size_t compressed_len = 0;
     u8* compressed =
       gif_compress_lzw(&lzw_alloc,
-                       lzw_hashmap_max_length,
+                       options->lzw_hashmap_max_length,
+                       clear_strategy,
                        gif_object.metadata.min_code_size,
-                       gif_object.indices,
-                       gif_object.metadata.width * gif_object.metadata.height,
+                       &lossy,
+                       &input,
                        &compressed_len);
+    /* The optimal parse reads the indices in order. */
+    if (options->effort == GIF_EFFORT_MAX && rows == NULL) {
+        size_t optimal_len = 0;
+        u8* optimal = gif_compress_lzw_optimal(&lzw_alloc,
+                                               gif_object.metadata.min_code_size,
+                                               gif_object.indices,
+                                               pixel_amount,
+                                               &optimal_len);
+        CLOG_INFO("Optimal parse: %zu bytes, greedy: %zu bytes.",
+                  optimal_len,
+                  compressed_len);
+        if (optimal_len < compressed_len) {
+            compressed = optimal;
+            compressed_len = optimal_len;
+            stats.optimal_parse = true;
+        }
+    }
+    stats.compressed_size = compressed_len;
 
     gif_write_img_data(&gif_data,
                        gif_object.metadata.min_code_size,
-                       max_block_length,
+                       options->max_block_length,
                        compressed,
                        compressed_len);
     gif_write_trailer(&gif_data);
@@ -814,6 +1533,13 @@ gif_export(GIFObject gif_object,
               lzw_arena.used / KILOBYTE,
               lzw_arena.size / KILOBYTE);
 
+    stats.file_size = gif_data.used;
     varena_destroy(&gif_data);
     varena_destroy(&lzw_arena);
+    free(remapped);
+    free(dense);
+    free(packed_row);
+    free(rows);
+
+    return stats;
 }
@@ -0,0 +1,248 @@
+#ifndef GIFBUF_INTERNAL_H
+#define GIFBUF_INTERNAL_H
+
+#include <gifbuf/gifbuf.h>
+
+#include "ccore.h"
+
+#define GIF_ALLOC_SIZE 1 * MEGABYTE
+#define LZW_ALLOC_SIZE 16 * MEGABYTE
+
+#define LSB_MASK(length) ((1 << (length)) - 1)
+
+#ifndef min
+#define min(a, b)                                                              \
+    ({                                                                         \
+        __typeof__(a) _a = (a);                                                \
+        __typeof__(b) _b = (b);                                                \
+        _a < _b ? _a : _b;                                                     \
+    })
+#endif
+
+#ifndef max
+#define max(a, b)                                                              \
+    ({                                                                         \
+        __typeof__(a) _a = (a);                                                \
+        __typeof__(b) _b = (b);                                                \
+        _a > _b ? _a : _b;                                                     \
+    })
+#endif
+
+#define GIF_MAX_THREADS 16
+#define GIF_MIN_PIXELS_PER_THREAD (64 * 1024)
+
+typedef void (*GIFParallelFn)(void* ctx,
+                             size_t thread,
+                             size_t begin,
+                             size_t end);
+
+u8
+gif_thread_count(u8 requested);
+u8
+gif_thread_count_for_pixels(size_t pixel_amount, u8 requested);
+void
+gif_parallel_for(size_t count, u8 thread_count, GIFParallelFn fn, void* ctx);
+
+/* Lookup cube over 5 bits per channel. */
+#define PALETTE_LUT_BITS 5
+#define PALETTE_LUT_SIZE (1 << (3 * PALETTE_LUT_BITS))
+#define PALETTE_LUT_EMPTY 0xffff
+
+#define PALETTE_LUT_KEY(r, g, b)                                               \
+    ((((r) >> 3) << (2 * PALETTE_LUT_BITS)) | (((g) >> 3) << PALETTE_LUT_BITS) | \
+     ((b) >> 3))
+
+struct GIFPaletteMapper
+{
+    GIFPaletteMapperOptions options;
+    GIFColor colors[256];
+    u16 point_amount;
+    /* Palette entries in distance space, sorted along search_axis. */
+    float points[256][3];
+    u8 point_indices[256];
+    int search_axis;
+    u16 lut[PALETTE_LUT_SIZE];
+};
+
+u16
+palette_mapper_fill(GIFPaletteMapper* mapper, u32 key);
+void
+palette_mapper_map_span(GIFPaletteMapper* mapper,
+                        const u8* rgba,
+                        size_t n,
+                        u8* out);
+
+/* LUT entries are filled on first use. Concurrent fills of the same entry
+   write the same value, the atomics only keep the accesses well defined. */
+static inline u8
+palette_mapper_lookup(GIFPaletteMapper* mapper, u32 key)
+{
+    u16 entry = __atomic_load_n(&mapper->lut[key], __ATOMIC_RELAXED);
+    if (entry != PALETTE_LUT_EMPTY)
+        return entry;
+    return palette_mapper_fill(mapper, key);
+}
+
+size_t
+quantize_sample_stride(size_t requested, size_t pixel_amount);
+size_t
+quantize_palette(const u8* const* frames,
+                 size_t frame_count,
+                 size_t pixel_amount,
+                 size_t stride,
+                 const GIFQuantizeOptions* options,
+                 GIFColor* out_palette,
+                 bool* has_transparency);
+
+void
+index_histogram(const u8* indices, size_t n, u32* counts);
+void
+index_remap(u8* out, const u8* in, size_t n, const u8* remap);
+u8
+gif_size_n_for_colors(size_t color_amount);
+/* Bits per index of a GIFPixelFormat holding indices, 0 otherwise. */
+u8
+gif_index_bits(GIFPixelFormat format);
+u16
+palette_minimize(const GIFObject* gif_object,
+                 const u32* counts,
+                 GIFColor* out_colors,
+                 u8* remap);
+void
+palette_order_frequency(const u32* counts, u16 amount, u8* order);
+void
+palette_order_chain(const GIFColor* colors,
+                    const u32* counts,
+                    u16 amount,
+                    u8* order);
+
+#define BIT_ARRAY_MIN_CAP 2 * KILOBYTE
+
+/* Codes are at most 12 bits wide. */
+#define LZW_MAX_CODES 4096
+
+typedef struct
+{
+    u8* array;
+    u8 next_byte;
+    u8 current_bit_idx;
+} BitArray;
+
+void
+bit_array_init(BitArray* bit_array, u8* buffer);
+void
+bit_array_push(BitArray* bit_array, u16 data, u8 bit_amount);
+void
+bit_array_pad_last_byte(BitArray* bit_array);
+
+/* Lets gif_compress_lzw extend a match with an index whose colour is within
+   threshold of the pixel's own, see gif_lossy_distance. */
+typedef struct
+{
+    const GIFColor* color_table;
+    u16 color_amount;
+    u32 threshold;
+    bool has_transparent_index;
+    u8 transparent_index;
+} LZWLossy;
+
+u32
+gif_lossy_distance(const GIFColor a, const GIFColor b);
+
+/* Bits of the image descriptor's packed byte. */
+#define GIF_LOCAL_TABLE_FLAG 0x80
+#define GIF_INTERLACE_FLAG 0x40
+#define GIF_LOCAL_SORT_FLAG 0x20
+#define GIF_INTERLACE_PASSES 4
+
+void
+gif_interlace_rows(u16 height,
+                   u16* rows,
+                   u16 pass_rows[GIF_INTERLACE_PASSES]);
+
+/* What gif_compress_lzw reads. */
+typedef struct
+{
+    const u8* indices;
+    size_t length;
+    u16 width;
+    /* Image row of each row in the stream for interlaced images, NULL to
+       read the rows in order. */
+    const u16* rows;
+    /* Bytes from one row of indices to the next. Rows that are not right
+       after each other are read one at a time. */
+    size_t stride;
+    /* Bits per index of packed rows, which are unpacked into row one at a
+       time. 0 for a byte per index. */
+    u8 packed_bits;
+    u8* row;
+} LZWInput;
+
+u8*
+gif_compress_lzw(Allocator* allocator,
+                 size_t lzw_hashmap_max_length,
+                 GIFClearStrategy clear_strategy,
+                 u8 min_code_size,
+                 const LZWLossy* lossy,
+                 const LZWInput* input,
+                 size_t* compressed_len);
+typedef void (*LZWPassFn)(void* ctx, u8 pass);
+
+/* Where gif_decompress_lzw writes the indices. */
+typedef struct
+{
+    u8* indices;
+    size_t length;
+    u16 width;
+    /* Image row of each row in the stream for interlaced images, NULL when
+       the rows come in order. */
+    const u16* rows;
+    /* Called with the pass number once the stream reaches each pass end. */
+    size_t pass_ends[GIF_INTERLACE_PASSES];
+    u8 pass_count;
+    LZWPassFn on_pass;
+    void* ctx;
+    /* Row mode: indices is left alone and each row of width indices goes to
+       on_row once complete, numbered in stream order. Returning false stops
+       the decode. */
+    bool (*on_row)(void* ctx, u32 row, const u8* indices);
+} LZWOutput;
+
+size_t
+gif_decompress_lzw(const u8* compressed,
+                   size_t compressed_len,
+                   u8 min_code_size,
+                   const LZWOutput* output);
+u8*
+gif_compress_lzw_optimal(Allocator* allocator,
+                         u8 min_code_size,
+                         const u8* indices,
+                         size_t indices_len,
+                         size_t* compressed_len);
+
+void
+gif_write_header(VArena* gif_data, GIFVersion version);
+void
+gif_write_logical_screen_descriptor(VArena* gif_data,
+                                    const GIFMetadata* metadata);
+void
+gif_write_global_color_table(VArena* gif_data, const GIFColor* colors);
+void
+gif_write_local_color_table(VArena* gif_data, const GIFColor* colors, u8 N);
+void
+gif_write_loop_extension(VArena* gif_data, u16 loop_count);
+void
+gif_write_graphics_control_extension(VArena* gif_data,
+                                     GIFGraphicControl control);
+void
+gif_write_img_descriptor(VArena* gif_data, const GIFMetadata* metadata);
+void
+gif_write_img_data(VArena* gif_data,
+                   u8 lzw_min_code,
+                   size_t max_block_length,
+                   u8* bytes,
+                   size_t bytes_length);
+void
+gif_write_trailer(VArena* gif_data);
+
+#endif // GIFBUF_INTERNAL_H
@@ -0,0 +1,192 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+#include "simd.h"
+
+/* Counts are spread over four tables so that runs of the same index do not
+   serialise on a single counter, eight indices are loaded at a time. */
+void
+index_histogram(const u8* indices, size_t n, u32* counts)
+{
+    u32 tables[4][256] = { { 0 } };
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        u64 word = 0;
+        memcpy(&word, indices + i, sizeof(u64));
+        tables[0][word & 0xff]++;
+        tables[1][(word >> 8) & 0xff]++;
+        tables[2][(word >> 16) & 0xff]++;
+        tables[3][(word >> 24) & 0xff]++;
+        tables[0][(word >> 32) & 0xff]++;
+        tables[1][(word >> 40) & 0xff]++;
+        tables[2][(word >> 48) & 0xff]++;
+        tables[3][word >> 56]++;
+    }
+    for (; i < n; i++) {
+        tables[0][indices[i]]++;
+    }
+
+    for (i = 0; i < 256; i++) {
+        counts[i] = tables[0][i] + tables[1][i] + tables[2][i] + tables[3][i];
+    }
+}
+
+void
+index_remap(u8* out, const u8* in, size_t n, const u8* remap)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        out[i] = remap[in[i]];
+        out[i + 1] = remap[in[i + 1]];
+        out[i + 2] = remap[in[i + 2]];
+        out[i + 3] = remap[in[i + 3]];
+    }
+    for (; i < n; i++) {
+        out[i] = remap[in[i]];
+    }
+}
+
+u8
+gif_index_bits(GIFPixelFormat format)
+{
+    switch (format) {
+        case GIF_PIXEL_INDEX:
+            return 8;
+        case GIF_PIXEL_INDEX4:
+            return 4;
+        case GIF_PIXEL_INDEX2:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+size_t
+gif_row_bytes(u16 width, GIFPixelFormat format)
+{
+    u8 bits = gif_index_bits(format);
+    return bits == 0 ? (size_t)width * 4 : ((size_t)width * bits + 7) / 8;
+}
+
+void
+gif_pack_indices(const u8* indices,
+                 size_t count,
+                 GIFPixelFormat format,
+                 u8* packed)
+{
+    u8 bits = gif_index_bits(format);
+    if (bits == 8)
+        memcpy(packed, indices, count);
+    else if (bits != 0)
+        simd_pack_indices(packed, indices, count, bits);
+}
+
+void
+gif_unpack_indices(const u8* packed,
+                   size_t count,
+                   GIFPixelFormat format,
+                   u8* indices)
+{
+    u8 bits = gif_index_bits(format);
+    if (bits == 8)
+        memcpy(indices, packed, count);
+    else if (bits != 0)
+        simd_unpack_indices(indices, packed, count, bits);
+}
+
+u8
+gif_size_n_for_colors(size_t color_amount)
+{
+    u8 size_n = 0;
+    while (size_n < 7 && (1u << (size_n + 1)) < color_amount)
+        size_n++;
+    return size_n;
+}
+
+/* Drops the palette entries no pixel uses, keeping the order of the rest.
+   The transparent index is kept even when unused. */
+u16
+palette_minimize(const GIFObject* gif_object,
+                 const u32* counts,
+                 GIFColor* out_colors,
+                 u8* remap)
+{
+    const GIFGraphicControl* control = &gif_object->graphic_control;
+    const bool has_transparency = gif_object->metadata.has_graphic_control &&
+                                  control->transparent_color_flag;
+    const size_t table_size = 1 << (gif_object->metadata.gct_size_n + 1);
+
+    u16 used = 0;
+    size_t i = 0;
+    for (i = 0; i < 256; i++) {
+        remap[i] = 0;
+        if (counts[i] == 0 &&
+            !(has_transparency && i == control->transparent_color_index))
+            continue;
+        if (i < table_size) {
+            memcpy(out_colors[used], gif_object->color_table[i], sizeof(GIFColor));
+        } else {
+            memset(out_colors[used], 0, sizeof(GIFColor));
+        }
+        remap[i] = used++;
+    }
+    return used;
+}
+
+/* order[new] = old for the first amount entries, most used first. */
+void
+palette_order_frequency(const u32* counts, u16 amount, u8* order)
+{
+    size_t i = 0, j = 0;
+    for (i = 0; i < amount; i++)
+        order[i] = i;
+    /* Insertion sort, stable so equal counts keep their order. */
+    for (i = 1; i < amount; i++) {
+        u8 entry = order[i];
+        for (j = i; j > 0 && counts[order[j - 1]] < counts[entry]; j--)
+            order[j] = order[j - 1];
+        order[j] = entry;
+    }
+}
+
+/* Greedy nearest neighbour chain through the colours, starting at the most
+   used one, so that neighbouring indices hold similar colours. */
+void
+palette_order_chain(const GIFColor* colors,
+                    const u32* counts,
+                    u16 amount,
+                    u8* order)
+{
+    bool visited[256] = { false };
+    size_t current = 0;
+    size_t i = 0, j = 0;
+    for (i = 1; i < amount; i++) {
+        if (counts[i] > counts[current])
+            current = i;
+    }
+
+    for (i = 0; i < amount; i++) {
+        order[i] = current;
+        visited[current] = true;
+        int best_distance = INT32_MAX;
+        size_t best = current;
+        for (j = 0; j < amount; j++) {
+            if (visited[j])
+                continue;
+            int dr = colors[j][0] - colors[current][0];
+            int dg = colors[j][1] - colors[current][1];
+            int db = colors[j][2] - colors[current][2];
+            int distance = dr * dr + dg * dg + db * db;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = j;
+            }
+        }
+        current = best;
+    }
+}
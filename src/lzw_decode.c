@@ -0,0 +1,592 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#define LZW_INLINE static inline __attribute__((always_inline))
+
+typedef struct
+{
+    const u8* data;
+    size_t length;
+    size_t position;
+    u64 bits;
+    u32 bit_count;
+} LZWBitReader;
+
+/* Pass callbacks of an LZWOutput, next is the stream length at which
+   lzw_event has something to do. */
+typedef struct
+{
+    const LZWOutput* output;
+    size_t next;
+    u8 pass;
+} LZWEvents;
+
+typedef struct
+{
+    LZWBitReader reader;
+    u8* out;
+    size_t out_len;
+    size_t written;
+    /* Interlaced output, see LZWOutput. */
+    const u16* rows;
+    u16 width;
+    LZWEvents events;
+    /* Every entry's string already sits in the output: entry code is the
+       length bytes at offset. */
+    u32 offset[LZW_MAX_CODES];
+    u16 length[LZW_MAX_CODES];
+    u32 count;
+    /* Where the last code's string was written. */
+    u32 previous_offset;
+    u16 previous_length;
+} LZWDecoder;
+
+typedef enum
+{
+    LZW_PHASE_NEXT,
+    LZW_PHASE_CLEAR,
+    LZW_PHASE_END
+} LZWPhaseResult;
+
+LZW_INLINE void
+lzw_refill(LZWBitReader* reader)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (reader->position + 8 <= reader->length) {
+        u64 word = 0;
+        memcpy(&word, reader->data + reader->position, sizeof(u64));
+        reader->bits |= word << reader->bit_count;
+        u32 bytes = (63 - reader->bit_count) >> 3;
+        reader->position += bytes;
+        reader->bit_count += bytes * 8;
+        return;
+    }
+#endif
+    while (reader->bit_count <= 56 && reader->position < reader->length) {
+        reader->bits |= (u64)reader->data[reader->position++]
+                        << reader->bit_count;
+        reader->bit_count += 8;
+    }
+}
+
+/* Next code of width bits, -1 once the data runs out. */
+LZW_INLINE i32
+lzw_read(LZWBitReader* reader, const u32 width)
+{
+    if (reader->bit_count < width) {
+        lzw_refill(reader);
+        if (reader->bit_count < width)
+            return -1;
+    }
+    u32 code = reader->bits & ((1u << width) - 1);
+    reader->bits >>= width;
+    reader->bit_count -= width;
+    return code;
+}
+
+/* Copies length bytes from earlier output in 32 byte steps, or 16 when the
+   source is closer than that, writing up to 31 bytes past the end. The
+   source must end before dst, bytes in between are fine, since each step
+   loads before it stores. */
+LZW_INLINE void
+lzw_copy_wide(u8* dst, const u8* src, size_t length)
+{
+    u8 chunk[32];
+    if (length <= 16 || dst - src >= 32) {
+        size_t i = 0;
+        for (i = 0; i + 16 <= length; i += 32) {
+            memcpy(chunk, src + i, 32);
+            memcpy(dst + i, chunk, 32);
+        }
+        if (i < length) {
+            memcpy(chunk, src + i, 16);
+            memcpy(dst + i, chunk, 16);
+        }
+        return;
+    }
+    size_t i = 0;
+    for (i = 0; i < length; i += 16) {
+        memcpy(chunk, src + i, 16);
+        memcpy(dst + i, chunk, 16);
+    }
+}
+
+/* Where stream position lands in the output of an interlaced image. */
+LZW_INLINE u8*
+lzw_at(const LZWDecoder* decoder, size_t position)
+{
+    return decoder->out + (size_t)decoder->rows[position / decoder->width] *
+                            decoder->width +
+           position % decoder->width;
+}
+
+/* Copies length bytes of the stream from src to dst one row piece at a
+   time. Both ranges are disjoint in the stream and so in the output. */
+static void
+lzw_copy_rows(const LZWDecoder* decoder, size_t dst, size_t src, size_t length)
+{
+    const u16 width = decoder->width;
+    while (length > 0) {
+        size_t piece = min(length, (size_t)(width - dst % width));
+        piece = min(piece, (size_t)(width - src % width));
+        memcpy(lzw_at(decoder, dst), lzw_at(decoder, src), piece);
+        dst += piece;
+        src += piece;
+        length -= piece;
+    }
+}
+
+/* Writes the string of code, read back from where it was written before.
+   With code == count it is the previous string followed by its own first
+   index, copied in place as in LZ77. Interlaced, every stream position goes
+   through its row. */
+LZW_INLINE void
+lzw_emit(LZWDecoder* decoder,
+         u32 code,
+         const u32 clear_code,
+         const bool interlaced)
+{
+    u8* out = decoder->out;
+    const size_t written = decoder->written;
+    const size_t room = decoder->out_len - written;
+    size_t length = 1;
+    if (code < clear_code) {
+        *(interlaced ? lzw_at(decoder, written) : out + written) = code;
+    } else if (interlaced) {
+        const bool repeat = code == decoder->count;
+        const size_t offset =
+          repeat ? decoder->previous_offset : decoder->offset[code];
+        length = repeat ? decoder->previous_length + 1u : decoder->length[code];
+        const size_t copied = repeat ? length - 1 : length;
+        lzw_copy_rows(decoder, written, offset, min(copied, room));
+        if (repeat && length <= room)
+            *lzw_at(decoder, written + length - 1) = *lzw_at(decoder, offset);
+        length = min(length, room);
+    } else {
+        const bool repeat = code == decoder->count;
+        const size_t offset =
+          repeat ? decoder->previous_offset : decoder->offset[code];
+        length = repeat ? decoder->previous_length + 1u : decoder->length[code];
+        const size_t copied = repeat ? length - 1 : length;
+        if (length + 32 <= room) {
+            lzw_copy_wide(out + written, out + offset, copied);
+        } else {
+            size_t i = 0;
+            for (i = 0; i < min(copied, room); i++)
+                out[written + i] = out[offset + i];
+        }
+        if (repeat && length <= room)
+            out[written + length - 1] = out[offset];
+        length = min(length, room);
+    }
+    decoder->previous_offset = written;
+    decoder->previous_length = length;
+    decoder->written = written + length;
+}
+
+static void
+lzw_events_init(LZWEvents* events, const LZWOutput* output)
+{
+    events->output = output;
+    events->pass = 0;
+    events->next = output->pass_count > 0 ? output->pass_ends[0]
+                                          : output->length;
+}
+
+/* Reports the passes written completes, true once the output is full. */
+static __attribute__((noinline)) bool
+lzw_event(LZWEvents* events, size_t written)
+{
+    const LZWOutput* output = events->output;
+    while (events->pass < output->pass_count &&
+           written >= output->pass_ends[events->pass]) {
+        events->pass++;
+        if (output->on_pass != NULL)
+            output->on_pass(output->ctx, events->pass);
+    }
+    events->next = events->pass < output->pass_count
+                     ? output->pass_ends[events->pass]
+                     : output->length;
+    return written >= output->length;
+}
+
+/* Decodes codes of one width until the dictionary reaches limit entries.
+   While growing, every code adds an entry. */
+LZW_INLINE LZWPhaseResult
+lzw_decode_phase(LZWDecoder* decoder,
+                 const u32 clear_code,
+                 const u32 width,
+                 const u32 limit,
+                 const bool growing,
+                 const bool interlaced)
+{
+    const u32 eoi_code = clear_code + 1;
+    while (!growing || decoder->count < limit) {
+        i32 code = lzw_read(&decoder->reader, width);
+        if (code < 0 || code == eoi_code)
+            return LZW_PHASE_END;
+        if (code == clear_code)
+            return LZW_PHASE_CLEAR;
+        if ((u32)code > decoder->count ||
+            (!growing && (u32)code == decoder->count)) {
+            CLOG_ERROR("Invalid LZW code %d with %u entries.",
+                       code,
+                       decoder->count);
+            return LZW_PHASE_END;
+        }
+
+        /* The new entry is the previous string followed by the first index
+           of this one, which is right where the previous one was written. */
+        const u32 entry_offset = decoder->previous_offset;
+        const u16 entry_length = decoder->previous_length + 1;
+        lzw_emit(decoder, code, clear_code, interlaced);
+        if (decoder->written >= decoder->events.next &&
+            lzw_event(&decoder->events, decoder->written))
+            return LZW_PHASE_END;
+
+        if (growing) {
+            decoder->offset[decoder->count] = entry_offset;
+            decoder->length[decoder->count] = entry_length;
+            decoder->count++;
+        }
+    }
+    return LZW_PHASE_NEXT;
+}
+
+/* The whole decoder for a min_code_size known at compile time: every width
+   gets its own loop with the width, masks and growth point as constants,
+   and a clear code restarts from the first one. */
+LZW_INLINE void
+lzw_decode_kernel(LZWDecoder* decoder,
+                  const u8 min_code_size,
+                  const bool interlaced)
+{
+    const u32 clear_code = 1u << min_code_size;
+    const u32 eoi_code = clear_code + 1;
+
+    LZWPhaseResult result = LZW_PHASE_NEXT;
+restart:
+    decoder->count = eoi_code + 1;
+    /* The first code after a clear adds no entry. */
+    for (;;) {
+        i32 code = lzw_read(&decoder->reader, min_code_size + 1);
+        if (code < 0 || code == eoi_code || code > eoi_code)
+            return;
+        if (code == clear_code)
+            continue;
+        lzw_emit(decoder, code, clear_code, interlaced);
+        break;
+    }
+    if (decoder->written >= decoder->events.next &&
+        lzw_event(&decoder->events, decoder->written))
+        return;
+
+#define LZW_DECODE_PHASE(width)                                                \
+    if ((width) > min_code_size) {                                             \
+        result = lzw_decode_phase(                                             \
+          decoder, clear_code, (width), 1u << (width), true, interlaced);      \
+        if (result == LZW_PHASE_CLEAR)                                         \
+            goto restart;                                                      \
+        if (result == LZW_PHASE_END)                                           \
+            return;                                                            \
+    }
+    LZW_DECODE_PHASE(2)
+    LZW_DECODE_PHASE(3)
+    LZW_DECODE_PHASE(4)
+    LZW_DECODE_PHASE(5)
+    LZW_DECODE_PHASE(6)
+    LZW_DECODE_PHASE(7)
+    LZW_DECODE_PHASE(8)
+    LZW_DECODE_PHASE(9)
+    LZW_DECODE_PHASE(10)
+    LZW_DECODE_PHASE(11)
+    LZW_DECODE_PHASE(12)
+#undef LZW_DECODE_PHASE
+
+    /* Full dictionary, kept until a clear code. */
+    result = lzw_decode_phase(
+      decoder, clear_code, 12, LZW_MAX_CODES, false, interlaced);
+    if (result == LZW_PHASE_CLEAR)
+        goto restart;
+}
+
+#define LZW_DECODE_INSTANCE(n)                                                 \
+    static void lzw_decode_##n(LZWDecoder* decoder)                            \
+    {                                                                          \
+        lzw_decode_kernel(decoder, n, false);                                  \
+    }
+LZW_DECODE_INSTANCE(2)
+LZW_DECODE_INSTANCE(3)
+LZW_DECODE_INSTANCE(4)
+LZW_DECODE_INSTANCE(5)
+LZW_DECODE_INSTANCE(6)
+LZW_DECODE_INSTANCE(7)
+LZW_DECODE_INSTANCE(8)
+#undef LZW_DECODE_INSTANCE
+
+/* Any other code size, e.g. the 1 bit some encoders write for two colour
+   images. */
+static void
+lzw_decode_any(LZWDecoder* decoder, u8 min_code_size)
+{
+    lzw_decode_kernel(decoder, min_code_size, false);
+}
+
+/* Interlaced images are rare enough for one generic kernel. */
+static void
+lzw_decode_interlaced(LZWDecoder* decoder, u8 min_code_size)
+{
+    lzw_decode_kernel(decoder, min_code_size, true);
+}
+
+/* Row mode keeps only the last LZW_RING_SIZE indices of the output, enough
+   for any row and string. An entry still in there is copied from it as in
+   the full decoder, an older one is rebuilt from its prefix codes. Wide
+   copies write up to 31 bytes ahead, over the oldest indices. */
+#define LZW_RING_SIZE (1u << 17)
+#define LZW_RING_MASK (LZW_RING_SIZE - 1)
+
+typedef struct
+{
+    LZWBitReader reader;
+    u8 ring[LZW_RING_SIZE + 32];
+    u32 offset[LZW_MAX_CODES];
+    u16 prefix[LZW_MAX_CODES];
+    u8 suffix[LZW_MAX_CODES];
+    u8 first[LZW_MAX_CODES];
+    u16 length[LZW_MAX_CODES];
+    /* A string rebuilt from its prefix codes, filled from its end. */
+    u8 string[LZW_MAX_CODES];
+    LZWEvents events;
+} LZWRowDecoder;
+
+/* Copies length bytes of the stream within the ring, src + length <= dst. */
+static inline void
+lzw_ring_copy(u8* ring, size_t dst, size_t src, size_t length)
+{
+    while (length > 0) {
+        size_t d = dst & LZW_RING_MASK, s = src & LZW_RING_MASK;
+        size_t piece = min(length, LZW_RING_SIZE - max(d, s));
+        memcpy(ring + d, ring + s, piece);
+        dst += piece;
+        src += piece;
+        length -= piece;
+    }
+}
+
+/* Writes the string of code at stream position written. */
+static inline void
+lzw_ring_emit(LZWRowDecoder* decoder,
+              u32 code,
+              bool repeat,
+              size_t written,
+              size_t length)
+{
+    u8* ring = decoder->ring;
+    const size_t offset = decoder->offset[code];
+    if (offset + LZW_RING_SIZE >= written + length + 32) {
+        const size_t copied = repeat ? length - 1 : length;
+        const size_t d = written & LZW_RING_MASK, s = offset & LZW_RING_MASK;
+        if (max(d, s) + length + 32 <= LZW_RING_SIZE)
+            lzw_copy_wide(ring + d, ring + s, copied);
+        else
+            lzw_ring_copy(ring, written, offset, copied);
+        if (repeat)
+            ring[(written + length - 1) & LZW_RING_MASK] =
+              ring[offset & LZW_RING_MASK];
+        return;
+    }
+
+    u8* string = decoder->string + LZW_MAX_CODES - length;
+    size_t i = 0;
+    for (i = length; i > 0; i--) {
+        string[i - 1] = decoder->suffix[code];
+        code = decoder->prefix[code];
+    }
+    while (length > 0) {
+        size_t w = written & LZW_RING_MASK;
+        size_t piece = min(length, LZW_RING_SIZE - w);
+        memcpy(ring + w, string, piece);
+        string += piece;
+        written += piece;
+        length -= piece;
+    }
+}
+
+/* Decodes into the ring, handing every row to on_row as it is complete. A
+   row cut short by the end of the data is padded with 0. */
+static size_t
+lzw_decode_rows(const u8* compressed,
+                size_t compressed_len,
+                u8 min_code_size,
+                const LZWOutput* output)
+{
+    const u32 clear_code = 1u << min_code_size;
+    const u32 eoi_code = clear_code + 1;
+    const size_t width = output->width;
+    const size_t out_len = output->length;
+    if (width == 0 || out_len < width)
+        return 0;
+
+    LZWRowDecoder* decoder = malloc(sizeof(LZWRowDecoder));
+    u8* row = malloc(width);
+    decoder->reader = (LZWBitReader){ .data = compressed,
+                                      .length = compressed_len };
+    lzw_events_init(&decoder->events, output);
+    u32 code = 0;
+    for (code = 0; code < clear_code; code++) {
+        decoder->suffix[code] = code;
+        decoder->first[code] = code;
+        decoder->length[code] = 1;
+    }
+
+    u32 count = eoi_code + 1;
+    u32 code_size = min_code_size + 1;
+    i32 previous = -1;
+    size_t previous_offset = 0;
+    size_t written = 0;
+    size_t row_index = 0;
+    bool done = false;
+    while (!done) {
+        i32 next = lzw_read(&decoder->reader, code_size);
+        if (next < 0 || (u32)next == eoi_code)
+            break;
+        if ((u32)next == clear_code) {
+            count = eoi_code + 1;
+            code_size = min_code_size + 1;
+            previous = -1;
+            continue;
+        }
+        code = next;
+        if (previous < 0 ? code > clear_code
+                         : code > count || code == LZW_MAX_CODES) {
+            CLOG_ERROR("Invalid LZW code %u with %u entries.", code, count);
+            break;
+        }
+
+        const bool repeat = code == count;
+        if (previous >= 0 && count < LZW_MAX_CODES) {
+            /* The previous string and the first index of this one, which is
+               right where the previous one was written. */
+            decoder->prefix[count] = previous;
+            decoder->suffix[count] =
+              decoder->first[repeat ? (u32)previous : code];
+            decoder->first[count] = decoder->first[previous];
+            decoder->length[count] = decoder->length[previous] + 1;
+            decoder->offset[count] = previous_offset;
+            count++;
+        }
+        previous = code;
+        /* Checked after the first code too, whose table is already full at
+           a minimum code size of 1. */
+        if (count >= (1u << code_size) && code_size < 12)
+            code_size++;
+
+        /* The ring takes all of the string, the output maybe less. */
+        if (code < clear_code)
+            decoder->ring[written & LZW_RING_MASK] = code;
+        else
+            lzw_ring_emit(
+              decoder, code, repeat, written, decoder->length[code]);
+        previous_offset = written;
+        written += min((size_t)decoder->length[code], out_len - written);
+
+        while (!done && written >= (row_index + 1) * width) {
+            const size_t start = (row_index * width) & LZW_RING_MASK;
+            const u8* complete = decoder->ring + start;
+            if (start + width > LZW_RING_SIZE) {
+                size_t head = LZW_RING_SIZE - start;
+                memcpy(row, complete, head);
+                memcpy(row + head, decoder->ring, width - head);
+                complete = row;
+            }
+            done = !output->on_row(output->ctx, row_index, complete);
+            row_index++;
+            const size_t rows_written = row_index * width;
+            if (rows_written >= decoder->events.next &&
+                lzw_event(&decoder->events, rows_written))
+                done = true;
+        }
+    }
+
+    if (!done && written > row_index * width) {
+        size_t i = 0;
+        for (i = 0; i < width; i++)
+            row[i] = i < written - row_index * width
+                       ? decoder->ring[(row_index * width + i) & LZW_RING_MASK]
+                       : 0;
+        output->on_row(output->ctx, row_index, row);
+    }
+    CLOG_DEBUG("Decompressed %zu of %zu indices in rows.", written, out_len);
+    free(row);
+    free(decoder);
+    return written;
+}
+
+size_t
+gif_decompress_lzw(const u8* compressed,
+                   size_t compressed_len,
+                   u8 min_code_size,
+                   const LZWOutput* output)
+{
+    const size_t out_len = output->length;
+    if (min_code_size == 0 || min_code_size > 11 || out_len == 0) {
+        CLOG_ERROR("Invalid LZW minimum code size %hhu.", min_code_size);
+        return 0;
+    }
+
+    if (output->on_row != NULL)
+        return lzw_decode_rows(compressed, compressed_len, min_code_size, output);
+
+    LZWDecoder* decoder = malloc(sizeof(LZWDecoder));
+    decoder->reader = (LZWBitReader){ .data = compressed,
+                                      .length = compressed_len };
+    decoder->out = output->indices;
+    decoder->out_len = out_len;
+    decoder->written = 0;
+    decoder->rows = output->rows;
+    decoder->width = output->width;
+    lzw_events_init(&decoder->events, output);
+
+    if (decoder->rows != NULL && decoder->width > 0) {
+        lzw_decode_interlaced(decoder, min_code_size);
+    } else {
+        switch (min_code_size) {
+            case 2:
+                lzw_decode_2(decoder);
+                break;
+            case 3:
+                lzw_decode_3(decoder);
+                break;
+            case 4:
+                lzw_decode_4(decoder);
+                break;
+            case 5:
+                lzw_decode_5(decoder);
+                break;
+            case 6:
+                lzw_decode_6(decoder);
+                break;
+            case 7:
+                lzw_decode_7(decoder);
+                break;
+            case 8:
+                lzw_decode_8(decoder);
+                break;
+            default:
+                lzw_decode_any(decoder, min_code_size);
+                break;
+        }
+    }
+
+    size_t written = decoder->written;
+    CLOG_DEBUG("Decompressed %zu of %zu indices.", written, out_len);
+    free(decoder);
+    return written;
+}
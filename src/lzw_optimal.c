@@ -0,0 +1,308 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+/* Shorter matches tried in place of the longest one. */
+#define OPTIMAL_CANDIDATES 4
+/* Indices each candidate parse is followed for before comparing. */
+#define OPTIMAL_LOOKAHEAD 256
+/* Once full, the dictionary is parsed in segments of the interval, before
+   each one it is checked against a fresh one over the coming window. */
+#define OPTIMAL_CLEAR_INTERVAL 2048
+#define OPTIMAL_CLEAR_WINDOW 16384
+
+/* LZW dictionary as a trie over codes. */
+typedef struct
+{
+    /* Child code per (code, next index), 0 when absent. Code 0 is a root and
+       never a child, so it doubles as the empty marker. */
+    u16* next;
+    u16 code_count;
+    u8 code_size;
+    /* Edges added since the last clear, for resets and rollbacks. */
+    u32* edges;
+    size_t edge_amount;
+} LZWTrie;
+
+typedef struct
+{
+    u16 code_count;
+    u8 code_size;
+    size_t edge_amount;
+} LZWTrieMark;
+
+static void
+trie_init(LZWTrie* trie, u8 min_code_size)
+{
+    trie->next = calloc((size_t)LZW_MAX_CODES * 256, sizeof(u16));
+    trie->edges = malloc(LZW_MAX_CODES * sizeof(u32));
+    trie->edge_amount = 0;
+    trie->code_count = (1 << min_code_size) + 2;
+    trie->code_size = min_code_size + 1;
+}
+
+static void
+trie_destroy(LZWTrie* trie)
+{
+    free(trie->next);
+    free(trie->edges);
+}
+
+static LZWTrieMark
+trie_mark(const LZWTrie* trie)
+{
+    return (LZWTrieMark){ .code_count = trie->code_count,
+                          .code_size = trie->code_size,
+                          .edge_amount = trie->edge_amount };
+}
+
+static void
+trie_rollback(LZWTrie* trie, LZWTrieMark mark)
+{
+    while (trie->edge_amount > mark.edge_amount)
+        trie->next[trie->edges[--trie->edge_amount]] = 0;
+    trie->code_count = mark.code_count;
+    trie->code_size = mark.code_size;
+}
+
+static void
+trie_reset(LZWTrie* trie, u8 min_code_size)
+{
+    LZWTrieMark empty = { .code_count = (1 << min_code_size) + 2,
+                          .code_size = min_code_size + 1,
+                          .edge_amount = 0 };
+    trie_rollback(trie, empty);
+}
+
+/* Longest match at pos. When codes is given, codes[l - 1] receives the code
+   of the match of length l. */
+static size_t
+trie_match(const LZWTrie* trie,
+           const u8* data,
+           size_t n,
+           size_t pos,
+           u16* code,
+           u16* codes)
+{
+    u16 current = data[pos];
+    size_t length = 1;
+    if (codes)
+        codes[0] = current;
+    while (pos + length < n) {
+        u16 child = trie->next[(u32)current * 256 + data[pos + length]];
+        if (child == 0)
+            break;
+        current = child;
+        if (codes)
+            codes[length] = current;
+        length++;
+    }
+    *code = current;
+    return length;
+}
+
+/* Emits code for the match ending before end and adds the entry extending it
+   by the next index, the same way gif_compress_lzw does. Returns the bits
+   the code takes. A string already in the dictionary still uses up a code,
+   as the decoder adds it regardless. */
+static u8
+trie_step(LZWTrie* trie, u16 code, const u8* data, size_t n, size_t end)
+{
+    u8 bits = trie->code_size;
+    if (end < n && trie->code_count < LZW_MAX_CODES) {
+        if (trie->code_count >= (1 << trie->code_size))
+            trie->code_size++;
+        u32 edge = (u32)code * 256 + data[end];
+        if (trie->next[edge] == 0) {
+            trie->next[edge] = trie->code_count;
+            trie->edges[trie->edge_amount++] = edge;
+        }
+        trie->code_count++;
+    }
+    return bits;
+}
+
+/* Greedy parse from pos until end is reached or passed. */
+static size_t
+trie_simulate(LZWTrie* trie,
+              const u8* data,
+              size_t n,
+              size_t pos,
+              size_t end,
+              size_t* reached)
+{
+    size_t bits = 0;
+    end = min(end, n);
+    while (pos < end) {
+        u16 code = 0;
+        size_t length = trie_match(trie, data, n, pos, &code, NULL);
+        bits += trie_step(trie, code, data, n, pos + length);
+        pos += length;
+    }
+    *reached = pos;
+    return bits;
+}
+
+/* Whether the coming window encodes in fewer bits after a clear than with the
+   current, full dictionary. */
+static bool
+optimal_should_clear(LZWTrie* trie,
+                     LZWTrie* fresh,
+                     const u8* data,
+                     size_t n,
+                     size_t pos,
+                     u8 min_code_size)
+{
+    size_t end = pos + OPTIMAL_CLEAR_WINDOW;
+    size_t keep_reached = 0, clear_reached = 0;
+
+    LZWTrieMark mark = trie_mark(trie);
+    size_t keep_bits = trie_simulate(trie, data, n, pos, end, &keep_reached);
+    trie_rollback(trie, mark);
+
+    trie_reset(fresh, min_code_size);
+    size_t clear_bits = trie->code_size + trie_simulate(fresh,
+                                                        data,
+                                                        n,
+                                                        pos,
+                                                        end,
+                                                        &clear_reached);
+
+    return (double)clear_bits / (clear_reached - pos) <
+           (double)keep_bits / (keep_reached - pos);
+}
+
+/* With the dictionary full every code has the same width, so the fewest
+   codes for [begin, end) are found exactly, as a shortest path over the
+   matches at every position. */
+static void
+optimal_parse_frozen(const LZWTrie* trie,
+                     const u8* data,
+                     size_t begin,
+                     size_t end,
+                     u32* cost,
+                     u16* choice,
+                     u16* codes,
+                     BitArray* bit_array)
+{
+    const size_t n = end - begin;
+    cost[n] = 0;
+    size_t i = n;
+    while (i-- > 0) {
+        u16 code = 0;
+        size_t longest = trie_match(trie, data, end, begin + i, &code, codes);
+        cost[i] = UINT32_MAX;
+        size_t length = longest;
+        for (length = longest; length > 0; length--) {
+            if (cost[i + length] + 1 < cost[i]) {
+                cost[i] = cost[i + length] + 1;
+                choice[i] = length;
+            }
+        }
+    }
+
+    for (i = 0; i < n; i += choice[i]) {
+        u16 code = 0;
+        trie_match(trie, data, end, begin + i, &code, codes);
+        bit_array_push(bit_array, codes[choice[i] - 1], trie->code_size);
+    }
+}
+
+/* Non-greedy LZW parse. At every step the longest match and a few shorter
+   ones are each followed by a greedy parse over a lookahead window, the one
+   spending the fewest bits per index wins. A shorter match adds a different
+   dictionary entry, which can pay off further on. Once the dictionary is
+   full the parse is exact, and a clear is only emitted when a fresh
+   dictionary encodes the coming window better. The stream is a regular GIF
+   LZW stream. */
+u8*
+gif_compress_lzw_optimal(Allocator* allocator,
+                         u8 min_code_size,
+                         const u8* indices,
+                         size_t indices_len,
+                         size_t* compressed_len)
+{
+    const u16 clear_code = 1 << min_code_size;
+    const u16 eoi_code = clear_code + 1;
+
+    LZWTrie trie, fresh;
+    trie_init(&trie, min_code_size);
+    trie_init(&fresh, min_code_size);
+    u16* codes = malloc(LZW_MAX_CODES * sizeof(u16));
+    u32* cost = malloc((OPTIMAL_CLEAR_INTERVAL + 1) * sizeof(u32));
+    u16* choice = malloc(OPTIMAL_CLEAR_INTERVAL * sizeof(u16));
+
+    u8* bit_array_buf = array(u8, BIT_ARRAY_MIN_CAP, allocator);
+    BitArray bit_array = { 0 };
+    bit_array_init(&bit_array, bit_array_buf);
+    bit_array_push(&bit_array, clear_code, trie.code_size);
+
+    size_t clear_count = 0;
+    size_t pos = 0;
+    while (pos < indices_len) {
+        if (trie.code_count >= LZW_MAX_CODES) {
+            if (optimal_should_clear(
+                  &trie, &fresh, indices, indices_len, pos, min_code_size)) {
+                bit_array_push(&bit_array, clear_code, trie.code_size);
+                trie_reset(&trie, min_code_size);
+                clear_count++;
+            } else {
+                size_t end = min(pos + OPTIMAL_CLEAR_INTERVAL, indices_len);
+                optimal_parse_frozen(
+                  &trie, indices, pos, end, cost, choice, codes, &bit_array);
+                pos = end;
+                continue;
+            }
+        }
+
+        u16 code = 0;
+        size_t longest =
+          trie_match(&trie, indices, indices_len, pos, &code, codes);
+        size_t length = longest;
+        if (longest > 1) {
+            const size_t end = pos + longest + OPTIMAL_LOOKAHEAD;
+            double best_cost = 0;
+            size_t candidate = longest;
+            for (candidate = longest;
+                 candidate > 0 && candidate + OPTIMAL_CANDIDATES > longest;
+                 candidate--) {
+                LZWTrieMark mark = trie_mark(&trie);
+                size_t reached = 0;
+                size_t bits = trie_step(
+                  &trie, codes[candidate - 1], indices, indices_len, pos + candidate);
+                bits += trie_simulate(
+                  &trie, indices, indices_len, pos + candidate, end, &reached);
+                trie_rollback(&trie, mark);
+
+                double cost = (double)bits / (reached - pos);
+                if (candidate == longest || cost < best_cost) {
+                    best_cost = cost;
+                    length = candidate;
+                }
+            }
+        }
+
+        bit_array_push(&bit_array, codes[length - 1], trie.code_size);
+        trie_step(&trie, codes[length - 1], indices, indices_len, pos + length);
+        pos += length;
+    }
+
+    bit_array_push(&bit_array, eoi_code, trie.code_size);
+    bit_array_pad_last_byte(&bit_array);
+    *compressed_len = array_len(bit_array.array);
+    CLOG_DEBUG("Optimal parse: %zu bytes, %zu clears.",
+               *compressed_len,
+               clear_count);
+
+    free(codes);
+    free(cost);
+    free(choice);
+    trie_destroy(&trie);
+    trie_destroy(&fresh);
+    return bit_array.array;
+}
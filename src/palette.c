@@ -0,0 +1,329 @@
+#include <gifbuf/gifbuf.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define MAPPER_DEFAULT_ALPHA_THRESHOLD 128
+
+static float
+srgb_to_linear(u8 value)
+{
+    float v = value / 255.0f;
+    return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static float
+lab_f(float t)
+{
+    const float delta = 6.0f / 29.0f;
+    return t > delta * delta * delta ? cbrtf(t)
+                                     : t / (3 * delta * delta) + 4.0f / 29.0f;
+}
+
+/* Maps a colour into the space the distance is euclidean in. */
+static void
+color_to_point(GIFColorDistance distance, u8 r, u8 g, u8 b, float* point)
+{
+    switch (distance) {
+        case GIF_DISTANCE_RGB:
+            point[0] = r;
+            point[1] = g;
+            point[2] = b;
+            break;
+        case GIF_DISTANCE_WEIGHTED_RGB:
+            /* Weights of 2, 4 and 3 applied to the squared channel errors. */
+            point[0] = r * 1.41421356f;
+            point[1] = g * 2.0f;
+            point[2] = b * 1.73205081f;
+            break;
+        case GIF_DISTANCE_LAB: {
+            float lr = srgb_to_linear(r);
+            float lg = srgb_to_linear(g);
+            float lb = srgb_to_linear(b);
+            /* D65 reference white. */
+            float x = (0.4124f * lr + 0.3576f * lg + 0.1805f * lb) / 0.95047f;
+            float y = 0.2126f * lr + 0.7152f * lg + 0.0722f * lb;
+            float z = (0.0193f * lr + 0.1192f * lg + 0.9505f * lb) / 1.08883f;
+            float fy = lab_f(y);
+            point[0] = 116.0f * fy - 16.0f;
+            point[1] = 500.0f * (lab_f(x) - fy);
+            point[2] = 200.0f * (fy - lab_f(z));
+            break;
+        }
+    }
+}
+
+static int
+compare_axis0(const void* a, const void* b)
+{
+    float d = ((const float*)a)[0] - ((const float*)b)[0];
+    return (d > 0) - (d < 0);
+}
+
+static int
+compare_axis1(const void* a, const void* b)
+{
+    float d = ((const float*)a)[1] - ((const float*)b)[1];
+    return (d > 0) - (d < 0);
+}
+
+static int
+compare_axis2(const void* a, const void* b)
+{
+    float d = ((const float*)a)[2] - ((const float*)b)[2];
+    return (d > 0) - (d < 0);
+}
+
+/* Nearest palette entry to point. Starts at the entry closest along the
+   search axis and walks outwards in both directions, stopping a direction
+   once the axis distance alone exceeds the best match. */
+static u8
+mapper_nearest(const GIFPaletteMapper* mapper, const float* point)
+{
+    const int axis = mapper->search_axis;
+    const float target = point[axis];
+
+    size_t low = 0;
+    size_t high = mapper->point_amount;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (mapper->points[middle][axis] < target)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    float best_distance = INFINITY;
+    size_t best = 0;
+    ptrdiff_t down = (ptrdiff_t)low - 1;
+    size_t up = low;
+    bool searching_down = down >= 0;
+    bool searching_up = up < mapper->point_amount;
+    while (searching_down || searching_up) {
+        if (searching_up) {
+            const float* p = mapper->points[up];
+            float da = p[axis] - target;
+            if (da * da >= best_distance) {
+                searching_up = false;
+            } else {
+                float d0 = p[0] - point[0];
+                float d1 = p[1] - point[1];
+                float d2 = p[2] - point[2];
+                float distance = d0 * d0 + d1 * d1 + d2 * d2;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = up;
+                }
+                up++;
+                searching_up = up < mapper->point_amount;
+            }
+        }
+        if (searching_down) {
+            const float* p = mapper->points[down];
+            float da = target - p[axis];
+            if (da * da >= best_distance) {
+                searching_down = false;
+            } else {
+                float d0 = p[0] - point[0];
+                float d1 = p[1] - point[1];
+                float d2 = p[2] - point[2];
+                float distance = d0 * d0 + d1 * d1 + d2 * d2;
+                if (distance < best_distance) {
+                    best_distance = distance;
+                    best = down;
+                }
+                down--;
+                searching_down = down >= 0;
+            }
+        }
+    }
+
+    return mapper->point_indices[best];
+}
+
+u16
+palette_mapper_fill(GIFPaletteMapper* mapper, u32 key)
+{
+    u8 r = ((key >> (2 * PALETTE_LUT_BITS)) << 3) | 4;
+    u8 g = (((key >> PALETTE_LUT_BITS) & LSB_MASK(PALETTE_LUT_BITS)) << 3) | 4;
+    u8 b = ((key & LSB_MASK(PALETTE_LUT_BITS)) << 3) | 4;
+    float point[3];
+    color_to_point(mapper->options.distance, r, g, b, point);
+    u16 entry = mapper_nearest(mapper, point);
+    __atomic_store_n(&mapper->lut[key], entry, __ATOMIC_RELAXED);
+    return entry;
+}
+
+GIFPaletteMapper*
+gif_palette_mapper_create(const GIFColor* colors,
+                          uint16_t color_amount,
+                          const GIFPaletteMapperOptions* options)
+{
+    GIFPaletteMapper* mapper = calloc(1, sizeof(GIFPaletteMapper));
+    if (options)
+        mapper->options = *options;
+    if (mapper->options.alpha_threshold == 0)
+        mapper->options.alpha_threshold = MAPPER_DEFAULT_ALPHA_THRESHOLD;
+    memset(mapper->lut, 0xff, sizeof(mapper->lut));
+
+    color_amount = min(color_amount, 256);
+    memcpy(mapper->colors, colors, color_amount * sizeof(GIFColor));
+    float low[3] = { INFINITY, INFINITY, INFINITY };
+    float high[3] = { -INFINITY, -INFINITY, -INFINITY };
+    /* Points are sorted together with their palette index in the 4th lane. */
+    float(*sortable)[4] = calloc(color_amount > 0 ? color_amount : 1,
+                                 sizeof(float[4]));
+    size_t amount = 0;
+    size_t i = 0;
+    for (i = 0; i < color_amount; i++) {
+        if (mapper->options.has_transparent_index &&
+            i == mapper->options.transparent_index)
+            continue;
+        color_to_point(mapper->options.distance,
+                       colors[i][0],
+                       colors[i][1],
+                       colors[i][2],
+                       sortable[amount]);
+        sortable[amount][3] = i;
+        int c = 0;
+        for (c = 0; c < 3; c++) {
+            low[c] = fminf(low[c], sortable[amount][c]);
+            high[c] = fmaxf(high[c], sortable[amount][c]);
+        }
+        amount++;
+    }
+
+    /* Searching along the widest axis prunes the most. */
+    int c = 0;
+    for (c = 1; c < 3; c++) {
+        if (high[c] - low[c] > high[mapper->search_axis] - low[mapper->search_axis])
+            mapper->search_axis = c;
+    }
+    int (*compare[3])(const void*, const void*) = {
+        compare_axis0, compare_axis1, compare_axis2
+    };
+    qsort(sortable, amount, sizeof(float[4]), compare[mapper->search_axis]);
+
+    for (i = 0; i < amount; i++) {
+        memcpy(mapper->points[i], sortable[i], sizeof(float[3]));
+        mapper->point_indices[i] = (u8)sortable[i][3];
+    }
+    mapper->point_amount = amount;
+    free(sortable);
+
+    return mapper;
+}
+
+void
+gif_palette_mapper_destroy(GIFPaletteMapper* mapper)
+{
+    free(mapper);
+}
+
+uint8_t
+gif_palette_mapper_map_color(GIFPaletteMapper* mapper, u8 r, u8 g, u8 b)
+{
+    if (mapper->point_amount == 0)
+        return mapper->options.transparent_index;
+    return palette_mapper_lookup(mapper, PALETTE_LUT_KEY(r, g, b));
+}
+
+/* Maps n RGBA pixels, computing LUT keys and alpha tests for four pixels at
+   a time. */
+void
+palette_mapper_map_span(GIFPaletteMapper* mapper,
+                        const u8* rgba,
+                        size_t n,
+                        u8* out)
+{
+    const u8 threshold = mapper->options.alpha_threshold;
+    const u8 transparent_index = mapper->options.transparent_index;
+    const bool has_transparent_index = mapper->options.has_transparent_index;
+
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i channel_mask = _mm_set1_epi32(0xf8);
+    const __m128i sign = _mm_set1_epi32(0x80000000);
+    const __m128i alpha_limit =
+      _mm_xor_si128(_mm_set1_epi32((u32)threshold << 24), sign);
+    u32 keys[4];
+    u32 transparent[4];
+    for (; i + 4 <= n; i += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+        __m128i r = _mm_and_si128(pixels, channel_mask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), channel_mask);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), channel_mask);
+        __m128i key = _mm_or_si128(
+          _mm_or_si128(_mm_slli_epi32(r, 7), _mm_slli_epi32(g, 2)),
+          _mm_srli_epi32(b, 3));
+        /* Unsigned alpha < threshold through a sign flipped compare. */
+        __m128i alpha = _mm_and_si128(pixels, _mm_set1_epi32(0xff000000));
+        __m128i is_transparent =
+          _mm_cmplt_epi32(_mm_xor_si128(alpha, sign), alpha_limit);
+        _mm_storeu_si128((__m128i*)keys, key);
+        _mm_storeu_si128((__m128i*)transparent, is_transparent);
+
+        int lane = 0;
+        for (lane = 0; lane < 4; lane++) {
+            out[i + lane] = has_transparent_index && transparent[lane]
+                              ? transparent_index
+                              : palette_mapper_lookup(mapper, keys[lane]);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        const u8* pixel = rgba + i * 4;
+        out[i] =
+          has_transparent_index && pixel[3] < threshold
+            ? transparent_index
+            : palette_mapper_lookup(
+                mapper, PALETTE_LUT_KEY(pixel[0], pixel[1], pixel[2]));
+    }
+}
+
+typedef struct
+{
+    GIFPaletteMapper* mapper;
+    const u8* rgba;
+    u8* out_indices;
+} MapperTask;
+
+static void
+mapper_map_range(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    MapperTask* task = ctx;
+    palette_mapper_map_span(task->mapper,
+                            task->rgba + begin * 4,
+                            end - begin,
+                            task->out_indices + begin);
+}
+
+void
+gif_palette_mapper_map(GIFPaletteMapper* mapper,
+                       const uint8_t* rgba,
+                       size_t pixel_amount,
+                       uint8_t* out_indices)
+{
+    if (mapper->point_amount == 0) {
+        memset(out_indices, mapper->options.transparent_index, pixel_amount);
+        return;
+    }
+
+    MapperTask task = { .mapper = mapper,
+                        .rgba = rgba,
+                        .out_indices = out_indices };
+    gif_parallel_for(
+      pixel_amount,
+      gif_thread_count_for_pixels(pixel_amount, mapper->options.thread_count),
+      mapper_map_range,
+      &task);
+}
@@ -0,0 +1,85 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "ccore.h"
+#include "gifbuf_internal.h"
+
+typedef struct
+{
+    GIFParallelFn fn;
+    void* ctx;
+    size_t thread;
+    size_t begin;
+    size_t end;
+} ParallelTask;
+
+static void*
+parallel_task_run(void* arg)
+{
+    ParallelTask* task = arg;
+    task->fn(task->ctx, task->thread, task->begin, task->end);
+    return NULL;
+}
+
+u8
+gif_thread_count(u8 requested)
+{
+    if (requested > 0)
+        return min(requested, GIF_MAX_THREADS);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    return min(cpus, GIF_MAX_THREADS);
+}
+
+/* Keeps small images on fewer threads than spawning them would cost. */
+u8
+gif_thread_count_for_pixels(size_t pixel_amount, u8 requested)
+{
+    u8 thread_count = gif_thread_count(requested);
+    if (pixel_amount < GIF_MIN_PIXELS_PER_THREAD * thread_count)
+        thread_count = max(pixel_amount / GIF_MIN_PIXELS_PER_THREAD, 1);
+    return thread_count;
+}
+
+/* Splits [0, count) into one contiguous range per thread. The calling thread
+   runs the first range itself. */
+void
+gif_parallel_for(size_t count, u8 thread_count, GIFParallelFn fn, void* ctx)
+{
+    thread_count = gif_thread_count(thread_count);
+    if (thread_count > count)
+        thread_count = count > 0 ? count : 1;
+
+    if (thread_count == 1) {
+        fn(ctx, 0, 0, count);
+        return;
+    }
+
+    ParallelTask tasks[GIF_MAX_THREADS];
+    pthread_t threads[GIF_MAX_THREADS];
+    bool started[GIF_MAX_THREADS] = { 0 };
+    size_t i = 0;
+    for (i = 0; i < thread_count; i++) {
+        tasks[i] = (ParallelTask){ .fn = fn,
+                                   .ctx = ctx,
+                                   .thread = i,
+                                   .begin = count * i / thread_count,
+                                   .end = count * (i + 1) / thread_count };
+    }
+    for (i = 1; i < thread_count; i++) {
+        started[i] =
+          pthread_create(&threads[i], NULL, parallel_task_run, &tasks[i]) == 0;
+        /* Fall back to running the range on this thread. */
+        if (!started[i])
+            parallel_task_run(&tasks[i]);
+    }
+    parallel_task_run(&tasks[0]);
+    for (i = 1; i < thread_count; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
@@ -0,0 +1,106 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#define PROBE_EXTENSION 0x21
+#define PROBE_IMAGE 0x2c
+#define PROBE_TRAILER 0x3b
+#define PROBE_GRAPHIC_CONTROL 0xf9
+#define PROBE_APPLICATION 0xff
+
+/* Position after the data sub-blocks starting at cursor, only their length
+   bytes are read. SIZE_MAX when the data ends before the terminator. */
+static inline size_t
+probe_skip_sub_blocks(const u8* data, size_t length, size_t cursor)
+{
+    while (cursor < length) {
+        u8 block_length = data[cursor];
+        cursor += block_length + 1;
+        if (block_length == 0)
+            return cursor;
+    }
+    return SIZE_MAX;
+}
+
+/* Reads the loop count of a NETSCAPE2.0 extension, cursor at its block
+   size byte. */
+static void
+probe_application(const u8* data,
+                  size_t length,
+                  size_t cursor,
+                  GIFProbeInfo* info)
+{
+    if (cursor + 16 > length || data[cursor] != 11 ||
+        (memcmp(data + cursor + 1, "NETSCAPE2.0", 11) != 0 &&
+         memcmp(data + cursor + 1, "ANIMEXTS1.0", 11) != 0))
+        return;
+    if (data[cursor + 12] == 3 && data[cursor + 13] == 1) {
+        info->has_loop_count = true;
+        info->loop_count = data[cursor + 14] | (data[cursor + 15] << 8);
+    }
+}
+
+bool
+gif_probe(const u8* data, size_t length, GIFProbeInfo* info)
+{
+    memset(info, 0, sizeof(GIFProbeInfo));
+    if (data == NULL || length < 13 || memcmp(data, "GIF", 3) != 0) {
+        CLOG_ERROR("Not a GIF.");
+        return false;
+    }
+
+    memcpy(&info->width, data + 6, sizeof(u16));
+    memcpy(&info->height, data + 8, sizeof(u16));
+    size_t cursor = 13;
+    if (data[10] & 0x80)
+        cursor += sizeof(GIFColor) << ((data[10] & 0x7) + 1);
+
+    u16 delay = 0;
+    while (cursor < length) {
+        switch (data[cursor]) {
+            case PROBE_TRAILER:
+                return true;
+            case PROBE_EXTENSION: {
+                if (cursor + 2 > length)
+                    break;
+                u8 label = data[cursor + 1];
+                cursor += 2;
+                if (label == PROBE_GRAPHIC_CONTROL && cursor + 5 <= length &&
+                    data[cursor] == 4)
+                    delay = data[cursor + 2] | (data[cursor + 3] << 8);
+                else if (label == PROBE_APPLICATION)
+                    probe_application(data, length, cursor, info);
+                cursor = probe_skip_sub_blocks(data, length, cursor);
+                continue;
+            }
+            case PROBE_IMAGE: {
+                /* Descriptor, local colour table and the minimum code size
+                   byte before the data. */
+                if (cursor + 10 > length)
+                    break;
+                u8 packed = data[cursor + 9];
+                cursor += 10;
+                if (packed & GIF_LOCAL_TABLE_FLAG)
+                    cursor += sizeof(GIFColor) << ((packed & 0x7) + 1);
+                cursor = probe_skip_sub_blocks(data, length, cursor + 1);
+                info->frame_count++;
+                info->duration += delay;
+                delay = 0;
+                continue;
+            }
+            default:
+                CLOG_ERROR("Unexpected block %02x at byte %zu.",
+                           data[cursor],
+                           cursor);
+                return false;
+        }
+        break;
+    }
+
+    CLOG_ERROR("GIF data ended before the trailer.");
+    return false;
+}
@@ -0,0 +1,527 @@
+#include <gifbuf/gifbuf.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#define QUANTIZE_DEFAULT_ALPHA_THRESHOLD 128
+#define QUANTIZE_DEFAULT_REFINE_ITERATIONS 4
+/* Pixels histogrammed when no sample stride is given. */
+#define QUANTIZE_DEFAULT_SAMPLES (1 << 20)
+
+/* Colours are histogrammed on a 5 bits per channel cube. */
+#define HISTOGRAM_BITS 5
+#define HISTOGRAM_SIZE (1 << (3 * HISTOGRAM_BITS))
+
+#define RGB15(r, g, b)                                                         \
+    ((((r) >> 3) << (2 * HISTOGRAM_BITS)) | (((g) >> 3) << HISTOGRAM_BITS) |   \
+     ((b) >> 3))
+
+typedef struct
+{
+    u32 count;
+    u64 sum[3];
+} QuantizeBin;
+
+/* An occupied histogram bin. */
+typedef struct
+{
+    u32 count;
+    float mean[3];
+} QuantizeColor;
+
+typedef struct
+{
+    size_t start;
+    size_t end;
+    u64 count;
+    double mean[3];
+    double sse;
+} QuantizeBox;
+
+static void
+box_measure(QuantizeBox* box, const QuantizeColor* colors)
+{
+    double sum[3] = { 0 };
+    box->count = 0;
+    size_t i = 0;
+    for (i = box->start; i < box->end; i++) {
+        int c = 0;
+        for (c = 0; c < 3; c++)
+            sum[c] += (double)colors[i].mean[c] * colors[i].count;
+        box->count += colors[i].count;
+    }
+    int c = 0;
+    for (c = 0; c < 3; c++)
+        box->mean[c] = sum[c] / box->count;
+
+    box->sse = 0;
+    for (i = box->start; i < box->end; i++) {
+        for (c = 0; c < 3; c++) {
+            double d = colors[i].mean[c] - box->mean[c];
+            box->sse += d * d * colors[i].count;
+        }
+    }
+}
+
+static int
+compare_red(const void* a, const void* b)
+{
+    float d = ((const QuantizeColor*)a)->mean[0] - ((const QuantizeColor*)b)->mean[0];
+    return (d > 0) - (d < 0);
+}
+
+static int
+compare_green(const void* a, const void* b)
+{
+    float d = ((const QuantizeColor*)a)->mean[1] - ((const QuantizeColor*)b)->mean[1];
+    return (d > 0) - (d < 0);
+}
+
+static int
+compare_blue(const void* a, const void* b)
+{
+    float d = ((const QuantizeColor*)a)->mean[2] - ((const QuantizeColor*)b)->mean[2];
+    return (d > 0) - (d < 0);
+}
+
+/* Splits box at the population median of its widest-variance axis. */
+static bool
+box_split(QuantizeBox* box, QuantizeBox* out, QuantizeColor* colors)
+{
+    if (box->end - box->start < 2)
+        return false;
+
+    double variance[3] = { 0 };
+    size_t i = 0;
+    int c = 0;
+    for (i = box->start; i < box->end; i++) {
+        for (c = 0; c < 3; c++) {
+            double d = colors[i].mean[c] - box->mean[c];
+            variance[c] += d * d * colors[i].count;
+        }
+    }
+    int axis = 0;
+    for (c = 1; c < 3; c++) {
+        if (variance[c] > variance[axis])
+            axis = c;
+    }
+
+    int (*compare[3])(const void*, const void*) = {
+        compare_red, compare_green, compare_blue
+    };
+    qsort(colors + box->start,
+          box->end - box->start,
+          sizeof(QuantizeColor),
+          compare[axis]);
+
+    u64 half = box->count / 2;
+    u64 acc = 0;
+    size_t split = box->start;
+    while (split < box->end - 1) {
+        acc += colors[split].count;
+        split++;
+        if (acc >= half)
+            break;
+    }
+
+    *out = (QuantizeBox){ .start = split, .end = box->end };
+    box->end = split;
+    box_measure(box, colors);
+    box_measure(out, colors);
+    return true;
+}
+
+static size_t
+median_cut(QuantizeColor* colors,
+           size_t color_amount,
+           size_t max_colors,
+           float (*palette)[3])
+{
+    QuantizeBox* boxes = calloc(max_colors, sizeof(QuantizeBox));
+    size_t box_amount = 1;
+    boxes[0] = (QuantizeBox){ .start = 0, .end = color_amount };
+    box_measure(&boxes[0], colors);
+
+    while (box_amount < max_colors) {
+        size_t worst = box_amount;
+        size_t i = 0;
+        for (i = 0; i < box_amount; i++) {
+            if (boxes[i].end - boxes[i].start < 2)
+                continue;
+            if (worst == box_amount || boxes[i].sse > boxes[worst].sse)
+                worst = i;
+        }
+        if (worst == box_amount)
+            break;
+        if (box_split(&boxes[worst], &boxes[box_amount], colors))
+            box_amount++;
+    }
+
+    size_t i = 0;
+    for (i = 0; i < box_amount; i++) {
+        int c = 0;
+        for (c = 0; c < 3; c++)
+            palette[i][c] = boxes[i].mean[c];
+    }
+    free(boxes);
+    return box_amount;
+}
+
+typedef struct
+{
+    const QuantizeColor* colors;
+    const float (*palette)[3];
+    size_t palette_amount;
+    u8* assignment;
+    /* Per-thread partial sums, palette_amount entries per thread. */
+    double (*sums)[4];
+} AssignTask;
+
+static void
+assign_range(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    AssignTask* task = ctx;
+    double(*sums)[4] = NULL;
+    if (task->sums)
+        sums = task->sums + thread * task->palette_amount;
+
+    size_t i = 0;
+    for (i = begin; i < end; i++) {
+        const float* color = task->colors[i].mean;
+        float best_distance = INFINITY;
+        size_t best = 0;
+        size_t p = 0;
+        for (p = 0; p < task->palette_amount; p++) {
+            float dr = color[0] - task->palette[p][0];
+            float dg = color[1] - task->palette[p][1];
+            float db = color[2] - task->palette[p][2];
+            float distance = dr * dr + dg * dg + db * db;
+            if (distance < best_distance) {
+                best_distance = distance;
+                best = p;
+            }
+        }
+        task->assignment[i] = best;
+        if (sums) {
+            u32 count = task->colors[i].count;
+            sums[best][0] += (double)color[0] * count;
+            sums[best][1] += (double)color[1] * count;
+            sums[best][2] += (double)color[2] * count;
+            sums[best][3] += count;
+        }
+    }
+}
+
+/* Lloyd iterations over the histogram bins, weighted by their population.
+   Assignment is split across threads, each accumulating its own sums. */
+static void
+kmeans_refine(const QuantizeColor* colors,
+              size_t color_amount,
+              float (*palette)[3],
+              size_t palette_amount,
+              u8* assignment,
+              u8 iterations,
+              u8 thread_count)
+{
+    thread_count = gif_thread_count(thread_count);
+    if (thread_count > color_amount)
+        thread_count = color_amount;
+
+    double(*sums)[4] =
+      calloc((size_t)thread_count * palette_amount, sizeof(double[4]));
+    AssignTask task = { .colors = colors,
+                        .palette = (const float(*)[3])palette,
+                        .palette_amount = palette_amount,
+                        .assignment = assignment,
+                        .sums = sums };
+
+    u8 iteration = 0;
+    for (iteration = 0; iteration < iterations; iteration++) {
+        memset(sums, 0, (size_t)thread_count * palette_amount * sizeof(double[4]));
+        gif_parallel_for(color_amount, thread_count, assign_range, &task);
+
+        float shift = 0;
+        size_t p = 0;
+        for (p = 0; p < palette_amount; p++) {
+            double total[4] = { 0 };
+            size_t t = 0;
+            for (t = 0; t < thread_count; t++) {
+                int c = 0;
+                for (c = 0; c < 4; c++)
+                    total[c] += sums[t * palette_amount + p][c];
+            }
+            /* Entries that lost all their colours keep their position. */
+            if (total[3] == 0)
+                continue;
+            int c = 0;
+            for (c = 0; c < 3; c++) {
+                float value = total[c] / total[3];
+                shift += fabsf(value - palette[p][c]);
+                palette[p][c] = value;
+            }
+        }
+        if (shift < 0.5f)
+            break;
+    }
+    free(sums);
+}
+
+typedef struct
+{
+    const u8* rgba;
+    size_t stride;
+    u8 alpha_threshold;
+    /* HISTOGRAM_SIZE bins per thread. */
+    QuantizeBin* histograms;
+    bool has_transparency[GIF_MAX_THREADS];
+} HistogramTask;
+
+/* Bins every stride-th pixel. Transparency is still checked on every pixel,
+   a sampled histogram must not miss it. */
+static void
+histogram_range(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    HistogramTask* task = ctx;
+    QuantizeBin* histogram = task->histograms + thread * HISTOGRAM_SIZE;
+    bool has_transparency = false;
+    size_t skip = (task->stride - begin % task->stride) % task->stride;
+    size_t i = 0;
+    for (i = begin; i < end; i++) {
+        const u8* pixel = task->rgba + i * 4;
+        if (pixel[3] < task->alpha_threshold) {
+            has_transparency = true;
+            continue;
+        }
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        skip = task->stride - 1;
+        QuantizeBin* bin = &histogram[RGB15(pixel[0], pixel[1], pixel[2])];
+        bin->count++;
+        bin->sum[0] += pixel[0];
+        bin->sum[1] += pixel[1];
+        bin->sum[2] += pixel[2];
+    }
+    task->has_transparency[thread] |= has_transparency;
+}
+
+size_t
+quantize_sample_stride(size_t requested, size_t pixel_amount)
+{
+    if (requested > 0)
+        return requested;
+    return max(pixel_amount / QUANTIZE_DEFAULT_SAMPLES, 1);
+}
+
+size_t
+quantize_palette(const u8* const* frames,
+                 size_t frame_count,
+                 size_t pixel_amount,
+                 size_t stride,
+                 const GIFQuantizeOptions* options,
+                 GIFColor* out_palette,
+                 bool* has_transparency)
+{
+    size_t max_colors = options->max_colors ? options->max_colors : 256;
+    max_colors = max(min(max_colors, 256), 2);
+    u8 iterations = options->refine_iterations
+                      ? options->refine_iterations
+                      : QUANTIZE_DEFAULT_REFINE_ITERATIONS;
+    u8 thread_count =
+      gif_thread_count_for_pixels(pixel_amount, options->thread_count);
+
+    HistogramTask histogram_task = {
+        .stride = max(stride, 1),
+        .alpha_threshold = options->alpha_threshold
+                             ? options->alpha_threshold
+                             : QUANTIZE_DEFAULT_ALPHA_THRESHOLD,
+        .histograms = calloc((size_t)thread_count * HISTOGRAM_SIZE,
+                             sizeof(QuantizeBin)),
+    };
+    size_t f = 0;
+    for (f = 0; f < frame_count; f++) {
+        histogram_task.rgba = frames[f];
+        gif_parallel_for(
+          pixel_amount, thread_count, histogram_range, &histogram_task);
+    }
+
+    /* Thread-local histograms are merged into the first one. */
+    QuantizeBin* histogram = histogram_task.histograms;
+    size_t i = 0;
+    size_t t = 0;
+    for (t = 0; t < thread_count; t++) {
+        *has_transparency |= histogram_task.has_transparency[t];
+        if (t == 0)
+            continue;
+        const QuantizeBin* local = histogram_task.histograms + t * HISTOGRAM_SIZE;
+        for (i = 0; i < HISTOGRAM_SIZE; i++) {
+            histogram[i].count += local[i].count;
+            histogram[i].sum[0] += local[i].sum[0];
+            histogram[i].sum[1] += local[i].sum[1];
+            histogram[i].sum[2] += local[i].sum[2];
+        }
+    }
+
+    QuantizeColor* colors = malloc(HISTOGRAM_SIZE * sizeof(QuantizeColor));
+    size_t color_amount = 0;
+    for (i = 0; i < HISTOGRAM_SIZE; i++) {
+        QuantizeBin* bin = &histogram[i];
+        if (bin->count == 0)
+            continue;
+        colors[color_amount++] =
+          (QuantizeColor){ .count = bin->count,
+                           .mean = { (float)bin->sum[0] / bin->count,
+                                     (float)bin->sum[1] / bin->count,
+                                     (float)bin->sum[2] / bin->count } };
+    }
+    free(histogram);
+
+    /* One entry is given up for the transparent index. */
+    size_t palette_max = *has_transparency ? max_colors - 1 : max_colors;
+    float(*palette)[3] = calloc(palette_max, sizeof(float[3]));
+    size_t palette_amount = 0;
+    if (color_amount > 0) {
+        palette_amount = median_cut(colors, color_amount, palette_max, palette);
+    }
+
+    if (options->refine && color_amount > 0) {
+        u8* assignment = malloc(color_amount);
+        kmeans_refine(colors,
+                      color_amount,
+                      palette,
+                      palette_amount,
+                      assignment,
+                      iterations,
+                      options->thread_count);
+        free(assignment);
+    }
+    free(colors);
+
+    for (i = 0; i < palette_amount; i++) {
+        int c = 0;
+        for (c = 0; c < 3; c++)
+            out_palette[i][c] = (u8)(palette[i][c] + 0.5f);
+    }
+    free(palette);
+
+    CLOG_DEBUG("Quantized %zu histogram colors to %zu palette entries%s",
+               color_amount,
+               palette_amount,
+               *has_transparency ? " (+ transparent)" : "");
+    return palette_amount;
+}
+
+void
+gif_quantize(const u8* rgba,
+             u16 width,
+             u16 height,
+             const GIFQuantizeOptions* options,
+             GIFObject* gif_object)
+{
+    GIFQuantizeOptions defaults = { 0 };
+    if (options == NULL)
+        options = &defaults;
+
+    const size_t pixel_amount = (size_t)width * height;
+    GIFColor palette[256];
+    bool has_transparency = false;
+    size_t palette_amount = quantize_palette(
+      &rgba, 1, pixel_amount, 1, options, palette, &has_transparency);
+
+    size_t color_total = palette_amount + has_transparency;
+    u8 gct_size_n = gif_size_n_for_colors(color_total);
+
+    GIFMetadata* metadata = &gif_object->metadata;
+    *metadata = (GIFMetadata){ .version = has_transparency ? GIF89a : GIF87a,
+                               .width = width,
+                               .height = height,
+                               .has_gct = true,
+                               .color_resolution = 7,
+                               .gct_size_n = gct_size_n,
+                               .min_code_size = max(gct_size_n + 1, 2),
+                               .has_graphic_control = has_transparency };
+    gif_object->graphic_control = (GIFGraphicControl){
+        .transparent_color_flag = has_transparency,
+        .transparent_color_index = palette_amount,
+    };
+
+    gif_object->color_table = calloc(1 << (gct_size_n + 1), sizeof(GIFColor));
+    memcpy(gif_object->color_table, palette, palette_amount * sizeof(GIFColor));
+
+    GIFPaletteMapperOptions mapper_options = {
+        .distance = options->distance,
+        .has_transparent_index = has_transparency,
+        .transparent_index = palette_amount,
+        .alpha_threshold = options->alpha_threshold,
+        .thread_count = options->thread_count,
+    };
+    GIFPaletteMapper* mapper = gif_palette_mapper_create(
+      gif_object->color_table, color_total, &mapper_options);
+    gif_object->indices = malloc(pixel_amount > 0 ? pixel_amount : 1);
+    gif_object->stride = 0;
+    gif_dither(
+      mapper, rgba, width, height, &options->dither, gif_object->indices);
+    gif_palette_mapper_destroy(mapper);
+}
+
+/* One palette for all frames, so a pixel that stays the same keeps its index
+   and the animation writer can crop it away. */
+void
+gif_quantize_frames(const u8* const* frames,
+                    size_t frame_count,
+                    GIFAnimationConfig* config)
+{
+    const size_t pixel_amount =
+      (size_t)config->metadata.width * config->metadata.height;
+    size_t stride =
+      quantize_sample_stride(config->sample_stride, pixel_amount * frame_count);
+
+    /* The transparent index the caller asked for, or the optimizer's delta
+       masking needs, is kept even for opaque frames. */
+    GIFColor palette[256];
+    bool has_transparency = config->has_transparent_index || config->optimize;
+    size_t palette_amount = quantize_palette(frames,
+                                             frame_count,
+                                             pixel_amount,
+                                             stride,
+                                             &config->quantize,
+                                             palette,
+                                             &has_transparency);
+
+    /* A transparent index the caller set is kept and the colours laid out
+       around it, otherwise it goes after them. */
+    if (!config->has_transparent_index)
+        config->transparent_index = palette_amount;
+    size_t color_total = palette_amount + has_transparency;
+    if (has_transparency)
+        color_total = max(color_total, (size_t)config->transparent_index + 1);
+    u8 gct_size_n = gif_size_n_for_colors(color_total);
+
+    config->metadata.has_gct = true;
+    config->metadata.color_resolution = 7;
+    config->metadata.gct_size_n = gct_size_n;
+    config->metadata.min_code_size = max(gct_size_n + 1, 2);
+    config->has_transparent_index = has_transparency;
+
+    /* Unused entries repeat the last colour so that mapping against the full
+       table never picks them. */
+    size_t table_size = 1 << (gct_size_n + 1);
+    config->color_table = calloc(table_size, sizeof(GIFColor));
+    size_t source = 0;
+    size_t i = 0;
+    for (i = 0; i < table_size && palette_amount > 0; i++) {
+        if (has_transparency && i == config->transparent_index)
+            continue;
+        memcpy(config->color_table[i],
+               palette[min(source, palette_amount - 1)],
+               sizeof(GIFColor));
+        source++;
+    }
+}
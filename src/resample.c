@@ -0,0 +1,344 @@
+#include <gifbuf/gifbuf.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Filter weights are fixed point with this many fraction bits, small enough
+   that a pair of them times a channel fits the 16 bit lanes of the SIMD
+   multiply. */
+#define RESAMPLE_BITS 14
+#define RESAMPLE_ONE (1 << RESAMPLE_BITS)
+
+/* The source pixels each destination pixel of a line is made of:
+   taps[i * max_taps + k] weighs source pixel starts[i] + k. */
+typedef struct
+{
+    u32* starts;
+    u32* counts;
+    i16* taps;
+    u32 max_taps;
+} ResampleWeights;
+
+static double
+resample_sinc(double x)
+{
+    if (x == 0)
+        return 1;
+    x *= M_PI;
+    return sin(x) / x;
+}
+
+static double
+resample_kernel(GIFFilter filter, double x)
+{
+    x = fabs(x);
+    switch (filter) {
+        case GIF_FILTER_BOX:
+            return x <= 0.5 ? 1 : 0;
+        case GIF_FILTER_BILINEAR:
+            return x < 1 ? 1 - x : 0;
+        case GIF_FILTER_LANCZOS3:
+            return x < 3 ? resample_sinc(x) * resample_sinc(x / 3) : 0;
+    }
+    return 0;
+}
+
+static double
+resample_support(GIFFilter filter)
+{
+    switch (filter) {
+        case GIF_FILTER_BOX:
+            return 0.5;
+        case GIF_FILTER_BILINEAR:
+            return 1;
+        case GIF_FILTER_LANCZOS3:
+            return 3;
+    }
+    return 1;
+}
+
+/* Weights of a line resized from source_size to size. On reduction the
+   kernel is stretched over the source pixels so that it averages them. */
+static void
+resample_weights(GIFFilter filter,
+                 u16 source_size,
+                 u16 size,
+                 ResampleWeights* weights)
+{
+    const double scale = (double)source_size / size;
+    const double stretch = max(scale, 1.0);
+    const double support = resample_support(filter) * stretch;
+    weights->max_taps = (u32)ceil(support) * 2 + 1;
+    weights->starts = malloc(size * sizeof(u32));
+    weights->counts = malloc(size * sizeof(u32));
+    weights->taps = calloc((size_t)size * weights->max_taps, sizeof(i16));
+    double* values = malloc(weights->max_taps * sizeof(double));
+
+    u32 i = 0;
+    for (i = 0; i < size; i++) {
+        const double center = (i + 0.5) * scale;
+        i32 first = (i32)floor(center - support);
+        i32 last = (i32)ceil(center + support);
+        first = max(first, 0);
+        last = min(last, (i32)source_size);
+        last = min(last, first + (i32)weights->max_taps);
+
+        double sum = 0;
+        i32 j = 0;
+        for (j = first; j < last; j++) {
+            values[j - first] =
+              resample_kernel(filter, (j + 0.5 - center) / stretch);
+            sum += values[j - first];
+        }
+
+        /* The fixed point weights add up to exactly one, the rounding error
+           going to the largest, so that flat areas stay flat. */
+        i16* taps = weights->taps + (size_t)i * weights->max_taps;
+        i32 total = 0;
+        u32 largest = 0;
+        for (j = 0; j < last - first; j++) {
+            taps[j] = (i16)lround(sum != 0 ? values[j] / sum * RESAMPLE_ONE
+                                           : 0);
+            total += taps[j];
+            if (taps[j] > taps[largest])
+                largest = j;
+        }
+        taps[largest] += RESAMPLE_ONE - total;
+
+        /* Zero weights at either end are left out. */
+        u32 count = last - first;
+        u32 skip = 0;
+        while (skip + 1 < count && taps[skip] == 0)
+            skip++;
+        while (count > skip + 1 && taps[count - 1] == 0)
+            count--;
+        memmove(taps, taps + skip, (count - skip) * sizeof(i16));
+        memset(taps + count - skip, 0, skip * sizeof(i16));
+        weights->starts[i] = first + skip;
+        weights->counts[i] = count - skip;
+    }
+    free(values);
+}
+
+static void
+resample_weights_free(ResampleWeights* weights)
+{
+    free(weights->starts);
+    free(weights->counts);
+    free(weights->taps);
+}
+
+static inline u8
+resample_clamp(i32 sum)
+{
+    sum = (sum + (RESAMPLE_ONE >> 1)) >> RESAMPLE_BITS;
+    return sum < 0 ? 0 : sum > 255 ? 255 : sum;
+}
+
+typedef struct
+{
+    const u8* src;
+    size_t src_stride;
+    u16 width;
+    u16 height;
+    u8* dst;
+    size_t dst_stride;
+    u16 dst_width;
+    u16 dst_height;
+    /* Rows resized horizontally, dst_width wide and height high. */
+    u8* middle;
+    ResampleWeights horizontal;
+    ResampleWeights vertical;
+} ResampleTask;
+
+/* Source rows with premultiplied alpha, resized horizontally into middle. */
+static void
+resample_rows_horizontal(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    ResampleTask* task = ctx;
+    const ResampleWeights* weights = &task->horizontal;
+    u8* row = malloc((size_t)task->width * 4);
+
+    size_t y = 0;
+    for (y = begin; y < end; y++) {
+        const u8* in = task->src + y * task->src_stride;
+        u32 x = 0;
+        for (x = 0; x < task->width; x++) {
+            const u32 alpha = in[x * 4 + 3];
+            int c = 0;
+            for (c = 0; c < 3; c++)
+                row[x * 4 + c] = (in[x * 4 + c] * alpha + 127) / 255;
+            row[x * 4 + 3] = alpha;
+        }
+
+        u8* out = task->middle + y * task->dst_width * 4;
+        for (x = 0; x < task->dst_width; x++) {
+            const u8* pixels = row + weights->starts[x] * 4;
+            const i16* taps = weights->taps + (size_t)x * weights->max_taps;
+            const u32 count = weights->counts[x];
+            u32 k = 0;
+#ifdef __SSE2__
+            /* Two source pixels at a time, their channels interleaved for
+               the multiply-add of the weight pair. */
+            const __m128i zero = _mm_setzero_si128();
+            __m128i sums = _mm_setzero_si128();
+            for (; k + 2 <= count; k += 2) {
+                __m128i pair = _mm_unpacklo_epi8(
+                  _mm_loadl_epi64((const __m128i*)(pixels + k * 4)), zero);
+                pair = _mm_unpacklo_epi16(pair, _mm_srli_si128(pair, 8));
+                __m128i weight = _mm_set1_epi32(
+                  (u16)taps[k] | ((u32)(u16)taps[k + 1] << 16));
+                sums = _mm_add_epi32(sums, _mm_madd_epi16(pair, weight));
+            }
+            i32 sum[4];
+            _mm_storeu_si128((__m128i*)sum, sums);
+#else
+            i32 sum[4] = { 0 };
+#endif
+            for (; k < count; k++) {
+                int c = 0;
+                for (c = 0; c < 4; c++)
+                    sum[c] += taps[k] * pixels[k * 4 + c];
+            }
+            int c = 0;
+            for (c = 0; c < 4; c++)
+                out[x * 4 + c] = resample_clamp(sum[c]);
+        }
+    }
+    free(row);
+}
+
+/* Rows of middle resized vertically into dst, alpha divided out again. */
+static void
+resample_rows_vertical(void* ctx, size_t thread, size_t begin, size_t end)
+{
+    ResampleTask* task = ctx;
+    const ResampleWeights* weights = &task->vertical;
+    const size_t row_bytes = (size_t)task->dst_width * 4;
+    const size_t middle_stride = row_bytes;
+
+    size_t y = 0;
+    for (y = begin; y < end; y++) {
+        const u8* rows = task->middle + weights->starts[y] * middle_stride;
+        const i16* taps = weights->taps + y * weights->max_taps;
+        const u32 count = weights->counts[y];
+        u8* out = task->dst + y * task->dst_stride;
+        size_t i = 0;
+#ifdef __SSE2__
+        /* Four pixels at a time, two source rows per multiply-add. */
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i round = _mm_set1_epi32(RESAMPLE_ONE >> 1);
+        for (; i + 16 <= row_bytes; i += 16) {
+            __m128i sums[4] = { round, round, round, round };
+            u32 k = 0;
+            for (k = 0; k < count; k += 2) {
+                const u8* first = rows + k * middle_stride + i;
+                __m128i a = _mm_loadu_si128((const __m128i*)first);
+                __m128i b = zero;
+                i16 second_tap = 0;
+                if (k + 1 < count) {
+                    b = _mm_loadu_si128(
+                      (const __m128i*)(first + middle_stride));
+                    second_tap = taps[k + 1];
+                }
+                __m128i weight = _mm_set1_epi32(
+                  (u16)taps[k] | ((u32)(u16)second_tap << 16));
+                __m128i a_low = _mm_unpacklo_epi8(a, zero);
+                __m128i a_high = _mm_unpackhi_epi8(a, zero);
+                __m128i b_low = _mm_unpacklo_epi8(b, zero);
+                __m128i b_high = _mm_unpackhi_epi8(b, zero);
+                const __m128i pairs[4] = { _mm_unpacklo_epi16(a_low, b_low),
+                                           _mm_unpackhi_epi16(a_low, b_low),
+                                           _mm_unpacklo_epi16(a_high, b_high),
+                                           _mm_unpackhi_epi16(a_high, b_high) };
+                int s = 0;
+                for (s = 0; s < 4; s++)
+                    sums[s] = _mm_add_epi32(sums[s],
+                                            _mm_madd_epi16(pairs[s], weight));
+            }
+            int s = 0;
+            for (s = 0; s < 4; s++)
+                sums[s] = _mm_srai_epi32(sums[s], RESAMPLE_BITS);
+            __m128i packed =
+              _mm_packus_epi16(_mm_packs_epi32(sums[0], sums[1]),
+                               _mm_packs_epi32(sums[2], sums[3]));
+            _mm_storeu_si128((__m128i*)(out + i), packed);
+        }
+#endif
+        for (; i < row_bytes; i++) {
+            i32 sum = 0;
+            u32 k = 0;
+            for (k = 0; k < count; k++)
+                sum += taps[k] * rows[k * middle_stride + i];
+            out[i] = resample_clamp(sum);
+        }
+
+        size_t x = 0;
+        for (x = 0; x < task->dst_width; x++) {
+            u8* pixel = out + x * 4;
+            const u32 alpha = pixel[3];
+            if (alpha == 255)
+                continue;
+            int c = 0;
+            for (c = 0; c < 3; c++) {
+                const u32 value =
+                  alpha > 0 ? (pixel[c] * 255 + alpha / 2) / alpha : 0;
+                pixel[c] = min(value, 255);
+            }
+        }
+    }
+}
+
+void
+gif_resample_rgba(const u8* src,
+                  size_t src_stride,
+                  u16 width,
+                  u16 height,
+                  u8* dst,
+                  size_t dst_stride,
+                  u16 dst_width,
+                  u16 dst_height,
+                  const GIFResampleOptions* options)
+{
+    if (width == 0 || height == 0 || dst_width == 0 || dst_height == 0)
+        return;
+
+    ResampleTask task = { .src = src,
+                          .src_stride = src_stride,
+                          .width = width,
+                          .height = height,
+                          .dst = dst,
+                          .dst_stride = dst_stride,
+                          .dst_width = dst_width,
+                          .dst_height = dst_height };
+    resample_weights(options->filter, width, dst_width, &task.horizontal);
+    resample_weights(options->filter, height, dst_height, &task.vertical);
+    task.middle = malloc((size_t)dst_width * height * 4);
+
+    /* Bands of source rows, then bands of destination rows. */
+    gif_parallel_for(height,
+                     gif_thread_count_for_pixels(
+                       (size_t)max(width, dst_width) * height,
+                       options->thread_count),
+                     resample_rows_horizontal,
+                     &task);
+    gif_parallel_for(dst_height,
+                     gif_thread_count_for_pixels(
+                       (size_t)dst_width * dst_height * task.vertical.max_taps,
+                       options->thread_count),
+                     resample_rows_vertical,
+                     &task);
+
+    free(task.middle);
+    resample_weights_free(&task.horizontal);
+    resample_weights_free(&task.vertical);
+}
@@ -0,0 +1,391 @@
+#ifndef GIFBUF_SIMD_H
+#define GIFBUF_SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Byte-wise helpers over index buffers. Each has an SSE2 path working on 16
+   bytes at a time and a scalar tail/fallback producing identical results. */
+
+/* Index of the first byte where a and b differ, n if equal. */
+static inline size_t
+simd_first_diff(const uint8_t* a, const uint8_t* b, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if (a[i] != b[i])
+            return i;
+    }
+    return n;
+}
+
+/* One past the index of the last byte where a and b differ, 0 if equal. */
+static inline size_t
+simd_last_diff(const uint8_t* a, const uint8_t* b, size_t n)
+{
+    size_t i = n;
+#ifdef __SSE2__
+    for (; i >= 16; i -= 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i - 16));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i - 16));
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        if (mask)
+            return i - 16 + (32 - __builtin_clz(mask));
+    }
+#endif
+    for (; i > 0; i--) {
+        if (a[i - 1] != b[i - 1])
+            return i;
+    }
+    return 0;
+}
+
+/* Number of leading bytes equal to value. Runs are checked 32 bytes at a
+   time. */
+static inline size_t
+simd_run_length(const uint8_t* bytes, size_t n, uint8_t value)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i v = _mm_set1_epi8((char)value);
+    for (; i + 32 <= n; i += 32) {
+        __m128i low = _mm_loadu_si128((const __m128i*)(bytes + i));
+        __m128i high = _mm_loadu_si128((const __m128i*)(bytes + i + 16));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(low, v)) |
+                        (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(high, v))
+                          << 16;
+        if (mask != 0xffffffffu)
+            return i + __builtin_ctz(~mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if (bytes[i] != value)
+            return i;
+    }
+    return n;
+}
+
+/* Number of bytes where a and b differ. Stops counting once limit is exceeded,
+   so the result is only exact up to limit + 16. */
+static inline size_t
+simd_count_diff(const uint8_t* a, const uint8_t* b, size_t n, size_t limit)
+{
+    size_t count = 0;
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n && count <= limit; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) & 0xffff;
+        count += __builtin_popcount(mask);
+    }
+#endif
+    for (; i < n && count <= limit; i++) {
+        count += a[i] != b[i];
+    }
+    return count;
+}
+
+/* out[i] = (src[i] == ref[i]) ? fill : src[i] */
+static inline void
+simd_mask_equal(uint8_t* out,
+                const uint8_t* src,
+                const uint8_t* ref,
+                size_t n,
+                uint8_t fill)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    __m128i vfill = _mm_set1_epi8((char)fill);
+    for (; i + 16 <= n; i += 16) {
+        __m128i vs = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i vr = _mm_loadu_si128((const __m128i*)(ref + i));
+        __m128i eq = _mm_cmpeq_epi8(vs, vr);
+        __m128i res =
+          _mm_or_si128(_mm_and_si128(eq, vfill), _mm_andnot_si128(eq, vs));
+        _mm_storeu_si128((__m128i*)(out + i), res);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = src[i] == ref[i] ? fill : src[i];
+    }
+}
+
+/* Span [first, last) of bytes where next == key but prev != key. Leaves
+   first == last == 0 when there are none. */
+static inline void
+simd_key_span(const uint8_t* next,
+              const uint8_t* prev,
+              size_t n,
+              uint8_t key,
+              size_t* first,
+              size_t* last)
+{
+    bool found = false;
+    size_t i = 0;
+    *first = 0;
+    *last = 0;
+#ifdef __SSE2__
+    __m128i vkey = _mm_set1_epi8((char)key);
+    for (; i + 16 <= n; i += 16) {
+        __m128i vn = _mm_loadu_si128((const __m128i*)(next + i));
+        __m128i vp = _mm_loadu_si128((const __m128i*)(prev + i));
+        unsigned mask = _mm_movemask_epi8(_mm_andnot_si128(
+          _mm_cmpeq_epi8(vp, vkey), _mm_cmpeq_epi8(vn, vkey)));
+        if (mask) {
+            if (!found)
+                *first = i + __builtin_ctz(mask);
+            *last = i + (32 - __builtin_clz(mask));
+            found = true;
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (next[i] == key && prev[i] != key) {
+            if (!found)
+                *first = i;
+            *last = i + 1;
+            found = true;
+        }
+    }
+}
+
+/* indices[i] = previous_indices[i] wherever the RGBA pixel i equals the one in
+   previous_rgba. */
+static inline void
+simd_keep_unchanged(uint8_t* indices,
+                    const uint8_t* previous_indices,
+                    const uint8_t* rgba,
+                    const uint8_t* previous_rgba,
+                    size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= n; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(previous_rgba + i * 4));
+        unsigned mask =
+          _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(va, vb)));
+        if (mask == 0xf) {
+            memcpy(indices + i, previous_indices + i, 4);
+        } else if (mask) {
+            int lane = 0;
+            for (lane = 0; lane < 4; lane++) {
+                if (mask & (1u << lane))
+                    indices[i + lane] = previous_indices[i + lane];
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        if (memcmp(rgba + i * 4, previous_rgba + i * 4, 4) == 0)
+            indices[i] = previous_indices[i];
+    }
+}
+
+/* 64-bit content hash, four independent lanes of 8 bytes each so the
+   multiplies pipeline. Not cryptographic, equal hashes still need a compare. */
+static inline uint64_t
+simd_hash(const uint8_t* bytes, size_t n)
+{
+    const uint64_t prime = 0x9e3779b97f4a7c15ull;
+    uint64_t lanes[4] = { prime, prime << 1, prime << 2, prime << 3 };
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        int lane = 0;
+        for (lane = 0; lane < 4; lane++) {
+            uint64_t word = 0;
+            memcpy(&word, bytes + i + lane * 8, sizeof(uint64_t));
+            lanes[lane] = (lanes[lane] ^ word) * prime;
+            lanes[lane] ^= lanes[lane] >> 29;
+        }
+    }
+    uint64_t hash = lanes[0] ^ (lanes[1] * 3) ^ (lanes[2] * 5) ^ (lanes[3] * 7);
+    for (; i < n; i++) {
+        hash = (hash ^ bytes[i]) * prime;
+    }
+    return hash ^ (hash >> 32) ^ n;
+}
+
+/* Packs n indices of bits 4 or 2 each into whole bytes, the first index in
+   the high bits. The last byte is padded with zero bits. */
+static inline void
+simd_pack_indices(uint8_t* out, const uint8_t* in, size_t n, uint8_t bits)
+{
+    const uint8_t mask = (1 << bits) - 1;
+    const size_t per_byte = 8 / bits;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i low_bytes = _mm_set1_epi16(0x00ff);
+    const __m128i index_mask = _mm_set1_epi8((char)mask);
+    if (bits == 4) {
+        for (; i + 32 <= n; i += 32) {
+            __m128i a = _mm_and_si128(
+              _mm_loadu_si128((const __m128i*)(in + i)), index_mask);
+            __m128i b = _mm_and_si128(
+              _mm_loadu_si128((const __m128i*)(in + i + 16)), index_mask);
+            a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low_bytes), 4),
+                             _mm_srli_epi16(a, 8));
+            b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low_bytes), 4),
+                             _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i*)(out + i / 2), _mm_packus_epi16(a, b));
+        }
+    } else {
+        const __m128i low_words = _mm_set1_epi32(0xffff);
+        for (; i + 64 <= n; i += 64) {
+            __m128i v[4];
+            int k = 0;
+            for (k = 0; k < 4; k++) {
+                __m128i x = _mm_and_si128(
+                  _mm_loadu_si128((const __m128i*)(in + i + k * 16)),
+                  index_mask);
+                x = _mm_or_si128(
+                  _mm_slli_epi16(_mm_and_si128(x, low_bytes), 2),
+                  _mm_srli_epi16(x, 8));
+                v[k] = _mm_or_si128(
+                  _mm_slli_epi32(_mm_and_si128(x, low_words), 4),
+                  _mm_srli_epi32(x, 16));
+            }
+            _mm_storeu_si128(
+              (__m128i*)(out + i / 4),
+              _mm_packus_epi16(_mm_packs_epi32(v[0], v[1]),
+                               _mm_packs_epi32(v[2], v[3])));
+        }
+    }
+#endif
+    for (; i < n; i += per_byte) {
+        uint8_t byte = 0;
+        size_t k = 0;
+        for (k = 0; k < per_byte; k++) {
+            byte <<= bits;
+            if (i + k < n)
+                byte |= in[i + k] & mask;
+        }
+        out[i / per_byte] = byte;
+    }
+}
+
+/* Inverse of simd_pack_indices, writes n indices. */
+static inline void
+simd_unpack_indices(uint8_t* out, const uint8_t* in, size_t n, uint8_t bits)
+{
+    const uint8_t mask = (1 << bits) - 1;
+    const size_t per_byte = 8 / bits;
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i index_mask = _mm_set1_epi8((char)mask);
+    if (bits == 4) {
+        for (; i + 32 <= n; i += 32) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(in + i / 2));
+            __m128i high = _mm_and_si128(_mm_srli_epi16(v, 4), index_mask);
+            __m128i low = _mm_and_si128(v, index_mask);
+            _mm_storeu_si128((__m128i*)(out + i),
+                             _mm_unpacklo_epi8(high, low));
+            _mm_storeu_si128((__m128i*)(out + i + 16),
+                             _mm_unpackhi_epi8(high, low));
+        }
+    } else {
+        for (; i + 64 <= n; i += 64) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(in + i / 4));
+            __m128i c0 = _mm_and_si128(_mm_srli_epi16(v, 6), index_mask);
+            __m128i c1 = _mm_and_si128(_mm_srli_epi16(v, 4), index_mask);
+            __m128i c2 = _mm_and_si128(_mm_srli_epi16(v, 2), index_mask);
+            __m128i c3 = _mm_and_si128(v, index_mask);
+            __m128i first = _mm_unpacklo_epi8(c0, c1);
+            __m128i second = _mm_unpacklo_epi8(c2, c3);
+            _mm_storeu_si128((__m128i*)(out + i),
+                             _mm_unpacklo_epi16(first, second));
+            _mm_storeu_si128((__m128i*)(out + i + 16),
+                             _mm_unpackhi_epi16(first, second));
+            first = _mm_unpackhi_epi8(c0, c1);
+            second = _mm_unpackhi_epi8(c2, c3);
+            _mm_storeu_si128((__m128i*)(out + i + 32),
+                             _mm_unpacklo_epi16(first, second));
+            _mm_storeu_si128((__m128i*)(out + i + 48),
+                             _mm_unpackhi_epi16(first, second));
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        const size_t shift = (per_byte - 1 - i % per_byte) * bits;
+        out[i] = (in[i / per_byte] >> shift) & mask;
+    }
+}
+
+/* out[i] = in[n - 1 - i], out and in do not overlap. */
+static inline void
+simd_reverse(uint8_t* out, const uint8_t* in, size_t n)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + n - 16 - i));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+        _mm_storeu_si128((__m128i*)(out + i), v);
+    }
+#endif
+    for (; i < n; i++) {
+        out[i] = in[n - 1 - i];
+    }
+}
+
+/* Transposes the 8 by 8 block at in into out, rows in_stride and out_stride
+   bytes apart, either of which may be negative. */
+static inline void
+simd_transpose8x8(uint8_t* out,
+                  ptrdiff_t out_stride,
+                  const uint8_t* in,
+                  ptrdiff_t in_stride)
+{
+#ifdef __SSE2__
+    __m128i rows[8];
+    int k = 0;
+    for (k = 0; k < 8; k++)
+        rows[k] = _mm_loadl_epi64((const __m128i*)(in + k * in_stride));
+    /* Interleaves bytes, then pairs, then quads of the row pairs. */
+    __m128i a0 = _mm_unpacklo_epi8(rows[0], rows[1]);
+    __m128i a1 = _mm_unpacklo_epi8(rows[2], rows[3]);
+    __m128i a2 = _mm_unpacklo_epi8(rows[4], rows[5]);
+    __m128i a3 = _mm_unpacklo_epi8(rows[6], rows[7]);
+    __m128i b0 = _mm_unpacklo_epi16(a0, a1);
+    __m128i b1 = _mm_unpackhi_epi16(a0, a1);
+    __m128i b2 = _mm_unpacklo_epi16(a2, a3);
+    __m128i b3 = _mm_unpackhi_epi16(a2, a3);
+    __m128i c[4] = { _mm_unpacklo_epi32(b0, b2),
+                     _mm_unpackhi_epi32(b0, b2),
+                     _mm_unpacklo_epi32(b1, b3),
+                     _mm_unpackhi_epi32(b1, b3) };
+    for (k = 0; k < 4; k++) {
+        _mm_storel_epi64((__m128i*)(out + 2 * k * out_stride), c[k]);
+        _mm_storel_epi64((__m128i*)(out + (2 * k + 1) * out_stride),
+                         _mm_unpackhi_epi64(c[k], c[k]));
+    }
+#else
+    int y = 0;
+    int x = 0;
+    for (y = 0; y < 8; y++) {
+        for (x = 0; x < 8; x++)
+            out[x * out_stride + y] = in[y * in_stride + x];
+    }
+#endif
+}
+
+#endif // GIFBUF_SIMD_H
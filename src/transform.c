@@ -0,0 +1,184 @@
+#include <gifbuf/gifbuf.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccore.h"
+#include "clog.h"
+#include "gifbuf_internal.h"
+#include "simd.h"
+
+/* Side of the square tiles a transpose works through, so that the rows it
+   reads and the ones it writes both stay in cache. */
+#define TRANSFORM_TILE 64
+
+GIFObject
+gif_crop(const GIFObject* gif_object, GIFRect rect)
+{
+    const u16 width = gif_object->metadata.width;
+    const u16 height = gif_object->metadata.height;
+    const size_t stride =
+      gif_object->stride != 0 ? gif_object->stride : width;
+    rect.left = min(rect.left, width);
+    rect.top = min(rect.top, height);
+    rect.width = min(rect.width, width - rect.left);
+    rect.height = min(rect.height, height - rect.top);
+
+    GIFObject view = *gif_object;
+    view.indices = gif_object->indices + rect.top * stride + rect.left;
+    view.stride = stride;
+    view.metadata.width = rect.width;
+    view.metadata.height = rect.height;
+    return view;
+}
+
+void
+gif_indices_flip(const u8* src,
+                 size_t src_stride,
+                 u16 width,
+                 u16 height,
+                 GIFFlip flip,
+                 u8* dst,
+                 size_t dst_stride)
+{
+    size_t y = 0;
+    for (y = 0; y < height; y++) {
+        const u8* row = src + y * src_stride;
+        if (flip == GIF_FLIP_HORIZONTAL)
+            simd_reverse(dst + y * dst_stride, row, width);
+        else
+            memcpy(dst + (height - 1 - y) * dst_stride, row, width);
+    }
+}
+
+/* out[x][y] = in[y][x] for the width by height image at in. */
+static void
+transform_transpose(u8* out,
+                    ptrdiff_t out_stride,
+                    const u8* in,
+                    ptrdiff_t in_stride,
+                    u16 width,
+                    u16 height)
+{
+    u32 tile_y = 0;
+    u32 tile_x = 0;
+    for (tile_y = 0; tile_y < height; tile_y += TRANSFORM_TILE) {
+        const u32 tile_bottom = min(tile_y + TRANSFORM_TILE, height);
+        for (tile_x = 0; tile_x < width; tile_x += TRANSFORM_TILE) {
+            const u32 tile_right = min(tile_x + TRANSFORM_TILE, width);
+            u32 y = 0;
+            u32 x = 0;
+            for (y = tile_y; y < tile_bottom; y += 8) {
+                for (x = tile_x; x < tile_right; x += 8) {
+                    if (y + 8 <= tile_bottom && x + 8 <= tile_right) {
+                        simd_transpose8x8(out + x * out_stride + y,
+                                          out_stride,
+                                          in + y * in_stride + x,
+                                          in_stride);
+                        continue;
+                    }
+                    /* Blocks at the right and bottom edges. */
+                    u32 block_y = 0;
+                    u32 block_x = 0;
+                    for (block_y = y; block_y < min(y + 8, tile_bottom);
+                         block_y++) {
+                        for (block_x = x; block_x < min(x + 8, tile_right);
+                             block_x++)
+                            out[block_x * out_stride + block_y] =
+                              in[block_y * in_stride + block_x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void
+gif_indices_rotate(const u8* src,
+                   size_t src_stride,
+                   u16 width,
+                   u16 height,
+                   GIFRotation rotation,
+                   u8* dst,
+                   size_t dst_stride)
+{
+    if (width == 0 || height == 0)
+        return;
+    switch (rotation) {
+        case GIF_ROTATE_90:
+            /* The transpose of the image upside down. */
+            transform_transpose(dst,
+                                dst_stride,
+                                src + (height - 1) * src_stride,
+                                -(ptrdiff_t)src_stride,
+                                width,
+                                height);
+            break;
+        case GIF_ROTATE_180: {
+            size_t y = 0;
+            for (y = 0; y < height; y++)
+                simd_reverse(dst + (height - 1 - y) * dst_stride,
+                             src + y * src_stride,
+                             width);
+            break;
+        }
+        case GIF_ROTATE_270:
+            /* The transpose written from the bottom row up. */
+            transform_transpose(dst + (width - 1) * dst_stride,
+                                -(ptrdiff_t)dst_stride,
+                                src,
+                                src_stride,
+                                width,
+                                height);
+            break;
+    }
+}
+
+/* Source position of the middle of pixel position of a size long line
+   resized from source_size. */
+static inline u16
+transform_nearest(u32 position, u16 size, u16 source_size)
+{
+    return ((2 * (u64)position + 1) * source_size) / (2 * (u64)size);
+}
+
+void
+gif_indices_resize(const u8* src,
+                   size_t src_stride,
+                   u16 width,
+                   u16 height,
+                   u8* dst,
+                   size_t dst_stride,
+                   u16 dst_width,
+                   u16 dst_height)
+{
+    if (width == 0 || height == 0 || dst_width == 0 || dst_height == 0)
+        return;
+    u16* columns = malloc(dst_width * sizeof(u16));
+    u32 x = 0;
+    for (x = 0; x < dst_width; x++)
+        columns[x] = transform_nearest(x, dst_width, width);
+
+    /* Rows sampling the same source row, as when enlarging, are copied. */
+    u32 y = 0;
+    u32 previous = UINT32_MAX;
+    for (y = 0; y < dst_height; y++) {
+        const u32 source_y = transform_nearest(y, dst_height, height);
+        u8* out = dst + y * dst_stride;
+        if (source_y == previous) {
+            memcpy(out, out - dst_stride, dst_width);
+            continue;
+        }
+        const u8* row = src + source_y * src_stride;
+        for (x = 0; x + 4 <= dst_width; x += 4) {
+            out[x] = row[columns[x]];
+            out[x + 1] = row[columns[x + 1]];
+            out[x + 2] = row[columns[x + 2]];
+            out[x + 3] = row[columns[x + 3]];
+        }
+        for (; x < dst_width; x++)
+            out[x] = row[columns[x]];
+        previous = source_y;
+    }
+    free(columns);
+}
@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 // Helper function to read a file's content into a dynamically allocated buffer
 // Returns the buffer and sets the size in *file_size.
@@ -457,6 +458,2056 @@ test_read_metadata(const MunitParameter params[], void* user_data_or_fixture)
     return 0;
 }
 
+/* Skips the image data sub-blocks following an image descriptor. */
+static size_t
+skip_img_data(const uint8_t* bytes)
+{
+    size_t cursor = 1;
+    while (bytes[cursor] != 0) {
+        cursor += bytes[cursor] + 1;
+    }
+    return cursor + 1;
+}
+
+static MunitResult
+test_animation_delta(const MunitParameter params[], void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .background = 0x10,
+                                          .color_resolution = 2,
+                                          .min_code_size = 6,
+                                          .gct_size_n = 5,
+                                          .width = 64,
+                                          .height = 64,
+                                          .has_gct = true };
+    GIFAnimationConfig config = { .metadata = metadata,
+                                  .color_table = cat64_colors,
+                                  .lzw_hashmap_max_length = 4096,
+                                  .max_block_length = 254,
+                                  .optimize = true,
+                                  .has_transparent_index = true,
+                                  .transparent_index = 0x3f };
+
+    uint8_t changed[64 * 64];
+    memcpy(changed, cat64_indices, sizeof(changed));
+    for (int y = 20; y < 30; y++) {
+        for (int x = 8; x < 40; x++) {
+            changed[y * 64 + x] = (changed[y * 64 + x] + 1) % 0x20;
+        }
+    }
+
+    GIFAnimation* animation =
+      gif_animation_begin(&config, "out/test_animation.gif");
+    munit_assert_not_null(animation);
+    gif_animation_add_frame(animation, cat64_indices, 10);
+    gif_animation_add_frame(animation, changed, 10);
+    gif_animation_add_frame(animation, changed, 10);
+    gif_animation_end(animation);
+
+    config.optimize = false;
+    animation = gif_animation_begin(&config, "out/test_animation_full.gif");
+    gif_animation_add_frame(animation, cat64_indices, 10);
+    gif_animation_add_frame(animation, changed, 10);
+    gif_animation_add_frame(animation, changed, 10);
+    gif_animation_end(animation);
+
+    size_t size = 0, full_size = 0;
+    uint8_t* file_data = read_file_to_buffer("out/test_animation.gif", &size);
+    uint8_t* full_data =
+      read_file_to_buffer("out/test_animation_full.gif", &full_size);
+    munit_assert_size(size, <, full_size);
+
+    GIFMetadata read_metadata = { 0 };
+    size_t cursor = 0;
+    cursor += gif_read_header(file_data, &read_metadata.version);
+    cursor +=
+      gif_read_logical_screen_descriptor(file_data + cursor, &read_metadata);
+    cursor += 3 * (1 << (read_metadata.gct_size_n + 1));
+    /* NETSCAPE2.0 loop extension */
+    cursor += 19;
+
+    const GIFRect expected[] = { { 0, 0, 64, 64 }, { 8, 20, 32, 10 }, { 0, 0, 1, 1 } };
+    for (int i = 0; i < 3; i++) {
+        GIFGraphicControl graphic_control = { 0 };
+        cursor += gif_read_graphic_control_extension(file_data + cursor,
+                                                     &graphic_control);
+        munit_assert_uint8(graphic_control.disposal_method, ==, 1);
+        munit_assert_true(graphic_control.transparent_color_flag);
+
+        cursor += gif_read_img_descriptor(file_data + cursor, &read_metadata);
+        munit_assert_uint16(read_metadata.left, ==, expected[i].left);
+        munit_assert_uint16(read_metadata.top, ==, expected[i].top);
+        munit_assert_uint16(read_metadata.width, ==, expected[i].width);
+        munit_assert_uint16(read_metadata.height, ==, expected[i].height);
+        cursor += skip_img_data(file_data + cursor);
+    }
+    munit_assert_uint8(file_data[cursor], ==, 0x3b);
+
+    free(file_data);
+    free(full_data);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_animation_duplicates(const MunitParameter params[],
+                          void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .background = 0x10,
+                                          .color_resolution = 2,
+                                          .min_code_size = 6,
+                                          .gct_size_n = 5,
+                                          .width = 64,
+                                          .height = 64,
+                                          .has_gct = true };
+    GIFAnimationConfig config = { .metadata = metadata,
+                                  .color_table = cat64_colors,
+                                  .lzw_hashmap_max_length = 4096,
+                                  .max_block_length = 254,
+                                  .optimize = true,
+                                  .merge_duplicates = true,
+                                  .near_duplicate_threshold = 4 };
+
+    uint8_t changed[64 * 64];
+    memcpy(changed, cat64_indices, sizeof(changed));
+    for (int i = 0; i < 64; i++) {
+        changed[i * 64 + i] = 0;
+    }
+    uint8_t near_changed[64 * 64];
+    memcpy(near_changed, changed, sizeof(near_changed));
+    near_changed[100] ^= 1;
+    near_changed[200] ^= 1;
+
+    GIFAnimation* animation =
+      gif_animation_begin(&config, "out/test_animation_duplicates.gif");
+    munit_assert_not_null(animation);
+    gif_animation_add_frame(animation, cat64_indices, 10);
+    gif_animation_add_frame(animation, cat64_indices, 10);
+    gif_animation_add_frame(animation, changed, 10);
+    gif_animation_add_frame(animation, near_changed, 15);
+    gif_animation_add_frame(animation, changed, 5);
+    gif_animation_end(animation);
+
+    size_t size = 0;
+    uint8_t* file_data =
+      read_file_to_buffer("out/test_animation_duplicates.gif", &size);
+
+    GIFMetadata read_metadata = { 0 };
+    size_t cursor = 0;
+    cursor += gif_read_header(file_data, &read_metadata.version);
+    cursor +=
+      gif_read_logical_screen_descriptor(file_data + cursor, &read_metadata);
+    cursor += 3 * (1 << (read_metadata.gct_size_n + 1));
+    cursor += 19;
+
+    const uint16_t expected_delays[] = { 20, 30 };
+    for (int i = 0; i < 2; i++) {
+        GIFGraphicControl graphic_control = { 0 };
+        cursor += gif_read_graphic_control_extension(file_data + cursor,
+                                                     &graphic_control);
+        munit_assert_uint16(graphic_control.delay_time, ==, expected_delays[i]);
+        cursor += gif_read_img_descriptor(file_data + cursor, &read_metadata);
+        cursor += skip_img_data(file_data + cursor);
+    }
+    munit_assert_uint8(file_data[cursor], ==, 0x3b);
+
+    free(file_data);
+
+    return MUNIT_OK;
+}
+
+static double
+quantize_error(const uint8_t* rgba, const GIFObject* gif_object)
+{
+    size_t pixel_amount =
+      gif_object->metadata.width * gif_object->metadata.height;
+    double error = 0;
+    for (size_t i = 0; i < pixel_amount; i++) {
+        const uint8_t* color = gif_object->color_table[gif_object->indices[i]];
+        for (int c = 0; c < 3; c++) {
+            error += abs((int)rgba[i * 4 + c] - color[c]);
+        }
+    }
+    return error / (pixel_amount * 3);
+}
+
+static MunitResult
+test_export_minimize(const MunitParameter params[], void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF87a,
+                                          .background = 0xe7,
+                                          .color_resolution = 6,
+                                          .min_code_size = 8,
+                                          .gct_size_n = 7,
+                                          .width = 256,
+                                          .height = 256,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = woman256_colors,
+                             .indices = woman256_indices,
+                             .metadata = metadata };
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254,
+                                 .minimize_palette = true };
+    gif_export_ex(gif_object, &options, "out/test_export_minimize.gif");
+
+    size_t size = 0, full_size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_export_minimize.gif", &size);
+    uint8_t* full_bytes =
+      read_file_to_buffer("test/test-images/woman256.gif", &full_size);
+    munit_assert_size(size, <, full_size);
+
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_uint8(imported.metadata.gct_size_n, ==, 5);
+    munit_assert_uint8(imported.metadata.min_code_size, ==, 6);
+    for (size_t i = 0; i < 256 * 256; i++) {
+        munit_assert_memory_equal(sizeof(GIFColor),
+                                  imported.color_table[imported.indices[i]],
+                                  woman256_colors[woman256_indices[i]]);
+    }
+
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    free(full_bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_export_palette_order(const MunitParameter params[],
+                          void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF87a,
+                                          .color_resolution = 6,
+                                          .min_code_size = 8,
+                                          .gct_size_n = 7,
+                                          .width = 256,
+                                          .height = 256,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = woman256_colors,
+                             .indices = woman256_indices,
+                             .metadata = metadata };
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254,
+                                 .minimize_palette = true,
+                                 .palette_order = GIF_PALETTE_ORDER_FREQUENCY };
+    gif_export_ex(gif_object, &options, "out/test_export_order.gif");
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_export_order.gif", &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_true(imported.metadata.sort);
+
+    size_t counts[256] = { 0 };
+    for (size_t i = 0; i < 256 * 256; i++) {
+        munit_assert_memory_equal(sizeof(GIFColor),
+                                  imported.color_table[imported.indices[i]],
+                                  woman256_colors[woman256_indices[i]]);
+        counts[imported.indices[i]]++;
+    }
+    for (int i = 1; i < 64; i++)
+        munit_assert_size(counts[i - 1], >=, counts[i]);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+
+    /* Lossless, the order cannot change the size and is not searched. */
+    options.palette_order = GIF_PALETTE_ORDER_NONE;
+    options.effort = GIF_EFFORT_MAX;
+    GIFExportStats stats =
+      gif_export_ex(gif_object, &options, "out/test_export_order.gif");
+    munit_assert_true(stats.palette_order_delta == 0);
+    munit_assert_size(stats.compressed_size, >, 0);
+
+    /* Lossy, max effort never does worse than the order given. */
+    options.lossy = 8;
+    stats = gif_export_ex(gif_object, &options, "out/test_export_order.gif");
+    munit_assert_true(stats.palette_order_delta <= 0);
+    options.lossy = 0;
+    stats = gif_export_ex(gif_object, &options, "out/test_export_order.gif");
+
+    bytes = read_file_to_buffer("out/test_export_order.gif", &size);
+    munit_assert_size(size, ==, stats.file_size);
+    gif_import(bytes, &imported);
+    for (size_t i = 0; i < 256 * 256; i++) {
+        munit_assert_memory_equal(sizeof(GIFColor),
+                                  imported.color_table[imported.indices[i]],
+                                  woman256_colors[woman256_indices[i]]);
+    }
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_clear_strategies(const MunitParameter params[],
+                      void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 7,
+                                          .min_code_size = 8,
+                                          .gct_size_n = 7,
+                                          .width = 620,
+                                          .height = 472,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = test_colors,
+                             .indices = test_indices,
+                             .metadata = metadata };
+    const size_t pixel_amount = 620 * 472;
+
+    /* Apart from on-full, the strategies keep the dictionary up to 4096
+       codes, also past a smaller lzw_hashmap_max_length. */
+    size_t sizes[GIF_CLEAR_EARLY + 1] = { 0 };
+    const size_t lengths[] = { 4096, 512 };
+    for (int l = 0; l < 2; l++) {
+        for (int strategy = GIF_CLEAR_ON_FULL; strategy <= GIF_CLEAR_EARLY;
+             strategy++) {
+            GIFExportOptions options = { .lzw_hashmap_max_length = lengths[l],
+                                         .clear_strategy = strategy,
+                                         .max_block_length = 254 };
+            GIFExportStats stats =
+              gif_export_ex(gif_object, &options, "out/test_clear.gif");
+            if (l == 0)
+                sizes[strategy] = stats.compressed_size;
+
+            size_t size = 0;
+            uint8_t* bytes = read_file_to_buffer("out/test_clear.gif", &size);
+            GIFObject imported = { 0 };
+            gif_import(bytes, &imported);
+            munit_assert_memory_equal(
+              pixel_amount, imported.indices, test_indices);
+            free(imported.indices);
+            free(imported.color_table);
+            free(bytes);
+        }
+    }
+    munit_assert_size(sizes[GIF_CLEAR_ADAPTIVE], <, sizes[GIF_CLEAR_ON_FULL]);
+
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254,
+                                 .effort = GIF_EFFORT_MAX };
+    GIFExportStats stats =
+      gif_export_ex(gif_object, &options, "out/test_clear.gif");
+    for (int strategy = GIF_CLEAR_ON_FULL; strategy <= GIF_CLEAR_EARLY;
+         strategy++) {
+        munit_assert_size(stats.compressed_size, <=, sizes[strategy]);
+    }
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_optimal_parse(const MunitParameter params[], void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 7,
+                                          .min_code_size = 8,
+                                          .gct_size_n = 7,
+                                          .width = 620,
+                                          .height = 472,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = test_colors,
+                             .indices = test_indices,
+                             .metadata = metadata };
+    const size_t pixel_amount = 620 * 472;
+
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .clear_strategy = GIF_CLEAR_ADAPTIVE,
+                                 .max_block_length = 254 };
+    GIFExportStats greedy =
+      gif_export_ex(gif_object, &options, "out/test_optimal.gif");
+    options.effort = GIF_EFFORT_MAX;
+    GIFExportStats stats =
+      gif_export_ex(gif_object, &options, "out/test_optimal.gif");
+    munit_assert_true(stats.optimal_parse);
+    munit_assert_size(stats.compressed_size, <, greedy.compressed_size);
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_optimal.gif", &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_memory_equal(pixel_amount, imported.indices, test_indices);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_lossy(const MunitParameter params[], void* user_data_or_fixture)
+{
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 7,
+                                          .min_code_size = 8,
+                                          .gct_size_n = 7,
+                                          .width = 620,
+                                          .height = 472,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = test_colors,
+                             .indices = test_indices,
+                             .metadata = metadata };
+    const size_t pixel_amount = 620 * 472;
+    const uint32_t threshold = 16;
+
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .clear_strategy = GIF_CLEAR_ADAPTIVE,
+                                 .max_block_length = 254 };
+    GIFExportStats lossless =
+      gif_export_ex(gif_object, &options, "out/test_lossy.gif");
+    options.lossy = threshold;
+    GIFExportStats lossy =
+      gif_export_ex(gif_object, &options, "out/test_lossy.gif");
+    munit_assert_size(lossy.compressed_size, <, lossless.compressed_size);
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_lossy.gif", &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    size_t changed = 0;
+    for (size_t i = 0; i < pixel_amount; i++) {
+        const uint8_t* a = imported.color_table[imported.indices[i]];
+        const uint8_t* b = test_colors[test_indices[i]];
+        int dr = a[0] - b[0], dg = a[1] - b[1], db = a[2] - b[2];
+        uint32_t distance = (2 * dr * dr + 4 * dg * dg + 3 * db * db) / 9;
+        munit_assert_uint32(distance, <=, threshold * threshold);
+        changed += imported.indices[i] != test_indices[i];
+    }
+    munit_assert_size(changed, >, 0);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_encode_runs(const MunitParameter params[], void* user_data_or_fixture)
+{
+    /* Flat bands with runs of every length, long enough to fill and clear
+       the dictionary several times. */
+    const uint16_t width = 1024, height = 512;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            uint8_t index = (y / 32) % 4;
+            if (y % 32 < 4 && x % (y + 3) < y % 7)
+                index = 4 + x % 3;
+            indices[y * width + x] = index;
+        }
+    }
+    GIFColor colors[8] = { { 0, 0, 0 },     { 255, 255, 255 }, { 255, 0, 0 },
+                           { 0, 255, 0 },   { 0, 0, 255 },     { 255, 255, 0 },
+                           { 0, 255, 255 }, { 255, 0, 255 } };
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 2,
+                                          .min_code_size = 3,
+                                          .gct_size_n = 2,
+                                          .width = width,
+                                          .height = height,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = colors,
+                             .indices = indices,
+                             .metadata = metadata };
+
+    for (int strategy = GIF_CLEAR_ON_FULL; strategy <= GIF_CLEAR_EARLY;
+         strategy++) {
+        GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                     .clear_strategy = strategy,
+                                     .max_block_length = 254 };
+        gif_export_ex(gif_object, &options, "out/test_runs.gif");
+
+        size_t size = 0;
+        uint8_t* bytes = read_file_to_buffer("out/test_runs.gif", &size);
+        GIFObject imported = { 0 };
+        gif_import(bytes, &imported);
+        munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+        free(imported.indices);
+        free(imported.color_table);
+        free(bytes);
+    }
+    free(indices);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_decode_code_sizes(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    const uint16_t width = 200, height = 150;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    GIFColor colors[256] = { { 0 } };
+    for (int i = 0; i < 256; i++)
+        colors[i][0] = colors[i][1] = colors[i][2] = i;
+
+    for (uint8_t min_code_size = 2; min_code_size <= 8; min_code_size++) {
+        const size_t color_amount = 1 << min_code_size;
+        for (size_t i = 0; i < pixel_amount; i++) {
+            size_t x = i % width, y = i / width;
+            indices[i] = (x / 3 + y * y / 7 + (x * y) % 5) % color_amount;
+        }
+        GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                              .color_resolution = 7,
+                                              .min_code_size = min_code_size,
+                                              .gct_size_n = min_code_size - 1,
+                                              .width = width,
+                                              .height = height,
+                                              .has_gct = true };
+        GIFObject gif_object = { .color_table = colors,
+                                 .indices = indices,
+                                 .metadata = metadata };
+        gif_export(gif_object, 4096, 254, "out/test_code_sizes.gif");
+
+        size_t size = 0;
+        uint8_t* bytes = read_file_to_buffer("out/test_code_sizes.gif", &size);
+        GIFObject imported = { 0 };
+        gif_import(bytes, &imported);
+        munit_assert_uint8(imported.metadata.min_code_size, ==, min_code_size);
+        munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+        free(imported.indices);
+        free(imported.color_table);
+        free(bytes);
+    }
+    free(indices);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_decode_long_strings(const MunitParameter params[],
+                         void* user_data_or_fixture)
+{
+    /* A flat area grows its run strings one index per code, each new one
+       coded before the decoder has it. Odd widths keep the strings from
+       lining up with the copy steps. */
+    const uint16_t width = 997, height = 61;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    for (size_t i = 0; i < pixel_amount; i++)
+        indices[i] = i < pixel_amount / 2 ? 0 : (i / 37) % 3;
+    GIFColor colors[4] = { { 0, 0, 0 },
+                           { 255, 255, 255 },
+                           { 255, 0, 0 },
+                           { 0, 0, 255 } };
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 1,
+                                          .min_code_size = 2,
+                                          .gct_size_n = 1,
+                                          .width = width,
+                                          .height = height,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = colors,
+                             .indices = indices,
+                             .metadata = metadata };
+    gif_export(gif_object, 4096, 254, "out/test_long_strings.gif");
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_long_strings.gif", &size);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    free(indices);
+
+    return MUNIT_OK;
+}
+
+typedef struct
+{
+    const uint8_t* expected;
+    uint8_t passes;
+    bool rows_correct;
+} InterlaceProgress;
+
+static const uint8_t interlace_starts[4] = { 0, 4, 2, 1 };
+static const uint8_t interlace_steps[4] = { 8, 8, 4, 2 };
+
+static void
+check_interlace_pass(const GIFObject* gif_object,
+                     uint8_t pass,
+                     uint8_t pass_count,
+                     void* user_data)
+{
+    InterlaceProgress* progress = user_data;
+    const uint16_t width = gif_object->metadata.width;
+    progress->passes++;
+    progress->rows_correct &= pass == progress->passes && pass_count == 4;
+    for (uint8_t done = 0; done < pass; done++) {
+        for (size_t y = interlace_starts[done];
+             y < gif_object->metadata.height;
+             y += interlace_steps[done])
+            progress->rows_correct &=
+              memcmp(gif_object->indices + y * width,
+                     progress->expected + y * width,
+                     width) == 0;
+    }
+}
+
+/* Copies the rows of indices into stream in interlace pass order. */
+static void
+interlace_stream(const uint8_t* indices,
+                 uint16_t width,
+                 uint16_t height,
+                 uint8_t* stream)
+{
+    size_t stream_row = 0;
+    for (int pass = 0; pass < 4; pass++) {
+        for (size_t y = interlace_starts[pass]; y < height;
+             y += interlace_steps[pass])
+            memcpy(stream + width * stream_row++, indices + y * width, width);
+    }
+}
+
+static MunitResult
+test_decode_interlaced(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    /* Encodes the rows in pass order and sets the interlace bit afterwards,
+       so strings run across rows of different passes. */
+    const uint16_t width = 53, height = 37;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    for (size_t i = 0; i < pixel_amount; i++)
+        indices[i] = (i % width < 20 ? 0 : (i / 7 + i / width)) % 16;
+    uint8_t* stream = malloc(pixel_amount);
+    interlace_stream(indices, width, height, stream);
+
+    GIFColor colors[16] = { { 0 } };
+    for (int i = 0; i < 16; i++)
+        colors[i][0] = colors[i][1] = colors[i][2] = i * 16;
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 3,
+                                          .min_code_size = 4,
+                                          .gct_size_n = 3,
+                                          .width = width,
+                                          .height = height,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = colors,
+                             .indices = stream,
+                             .metadata = metadata };
+    gif_export(gif_object, 4096, 254, "out/test_interlaced.gif");
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_interlaced.gif", &size);
+    size_t cursor = 13 + 3 * 16;
+    if (bytes[cursor] == '!') {
+        GIFGraphicControl graphic_control = { 0 };
+        cursor += gif_read_graphic_control_extension(bytes + cursor,
+                                                     &graphic_control);
+    }
+    munit_assert_uint8(bytes[cursor], ==, ',');
+    bytes[cursor + 9] |= 0x40;
+
+    InterlaceProgress progress = { .expected = indices,
+                                   .rows_correct = true };
+    GIFImportOptions options = { .progress = check_interlace_pass,
+                                 .user_data = &progress };
+    GIFObject imported = { 0 };
+    gif_import_ex(bytes, &options, &imported);
+    munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+    munit_assert_uint8(progress.passes, ==, 4);
+    munit_assert_true(progress.rows_correct);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    free(stream);
+    free(indices);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_export_interlaced(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    /* Interlaced export must give the image data of the rows reordered by
+       hand, and read back in image order. */
+    const uint16_t width = 61, height = 45;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    for (size_t i = 0; i < pixel_amount; i++)
+        indices[i] = (i % width > 40 ? 3 : (i / 5 + (i / width) * 3)) % 16;
+    uint8_t* stream = malloc(pixel_amount);
+    interlace_stream(indices, width, height, stream);
+
+    GIFColor colors[16] = { { 0 } };
+    for (int i = 0; i < 16; i++)
+        colors[i][0] = colors[i][1] = colors[i][2] = i * 16;
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 3,
+                                          .min_code_size = 4,
+                                          .gct_size_n = 3,
+                                          .width = width,
+                                          .height = height,
+                                          .has_gct = true };
+    GIFObject gif_object = { .color_table = colors,
+                             .indices = stream,
+                             .metadata = metadata };
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254 };
+    gif_export_ex(gif_object, &options, "out/test_export_interlaced.gif");
+    size_t reordered_size = 0;
+    uint8_t* reordered =
+      read_file_to_buffer("out/test_export_interlaced.gif", &reordered_size);
+
+    gif_object.indices = indices;
+    options.interlace = true;
+    gif_export_ex(gif_object, &options, "out/test_export_interlaced.gif");
+    size_t size = 0;
+    uint8_t* bytes =
+      read_file_to_buffer("out/test_export_interlaced.gif", &size);
+    munit_assert_size(size, ==, reordered_size);
+    size_t descriptor = 13 + 3 * 16;
+    munit_assert_uint8(bytes[descriptor], ==, ',');
+    munit_assert_uint8(bytes[descriptor + 9], ==, 0x40);
+    reordered[descriptor + 9] |= 0x40;
+    munit_assert_memory_equal(size, bytes, reordered);
+
+    /* Importing and exporting again keeps it interlaced. */
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+    options.interlace = false;
+    gif_export_ex(imported, &options, "out/test_export_interlaced.gif");
+    free(bytes);
+    bytes = read_file_to_buffer("out/test_export_interlaced.gif", &size);
+    munit_assert_memory_equal(size, bytes, reordered);
+
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+    free(reordered);
+    free(stream);
+    free(indices);
+
+    /* Noise takes more LZW data than there are pixels, which all has to be
+       read back, as indices and as RGBA. */
+    GIFColor noise_colors[256];
+    for (int i = 0; i < 256; i++)
+        noise_colors[i][0] = noise_colors[i][1] = noise_colors[i][2] = i;
+    uint8_t noise[64 * 64];
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        seed = seed * 1103515245 + 12345;
+        noise[i] = seed >> 24;
+    }
+    gif_object = (GIFObject){ .color_table = noise_colors,
+                              .indices = noise,
+                              .metadata = { .version = GIF89a,
+                                            .color_resolution = 7,
+                                            .min_code_size = 8,
+                                            .gct_size_n = 7,
+                                            .width = 64,
+                                            .height = 64,
+                                            .has_gct = true } };
+    options.interlace = true;
+    GIFExportStats stats =
+      gif_export_ex(gif_object, &options, "out/test_export_interlaced.gif");
+    munit_assert_size(stats.compressed_size, >, sizeof(noise));
+    bytes = read_file_to_buffer("out/test_export_interlaced.gif", &size);
+    gif_import(bytes, &imported);
+    munit_assert_memory_equal(sizeof(noise), imported.indices, noise);
+    free(imported.indices);
+    free(imported.color_table);
+
+    uint8_t* rgba = malloc(sizeof(noise) * 4);
+    GIFPixelBuffer buffer = { .pixels = rgba,
+                              .stride = 64 * 4,
+                              .format = GIF_PIXEL_RGBA };
+    gif_import_into(bytes, NULL, &buffer, &imported);
+    for (size_t i = 0; i < sizeof(noise); i++)
+        munit_assert_uint8(rgba[i * 4], ==, noise[i]);
+    free(imported.color_table);
+    free(rgba);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static void
+fill_palette_frame(uint8_t* rgba, bool warm, int square_x)
+{
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            uint8_t* pixel = rgba + (y * 64 + x) * 4;
+            pixel[0] = warm ? x * 4 : 0;
+            pixel[1] = y * 2;
+            pixel[2] = warm ? 0 : x * 4;
+            pixel[3] = 255;
+            if (x >= square_x && x < square_x + 8 && y >= 24 && y < 32)
+                memset(pixel, 255, 3);
+        }
+    }
+}
+
+/* Reads the next frame's image descriptor, skipping its extension, local
+   color table and data. */
+static size_t
+read_frame_descriptor(const uint8_t* bytes, GIFMetadata* metadata)
+{
+    GIFGraphicControl graphic_control = { 0 };
+    size_t cursor = gif_read_graphic_control_extension(bytes, &graphic_control);
+    cursor += gif_read_img_descriptor(bytes + cursor, metadata);
+    if (metadata->local_color_table & 0x80)
+        cursor += 3 * (1 << ((metadata->local_color_table & 0x7) + 1));
+    return cursor + skip_img_data(bytes + cursor);
+}
+
+static MunitResult
+test_animation_palette(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    uint8_t* frames[4];
+    for (int i = 0; i < 4; i++) {
+        frames[i] = malloc(64 * 64 * 4);
+        fill_palette_frame(frames[i], i < 2, 8 + (i % 2) * 4);
+    }
+
+    GIFAnimationConfig config = {
+        .metadata = { .width = 64, .height = 64 },
+        .lzw_hashmap_max_length = 4096,
+        .max_block_length = 254,
+        .optimize = true,
+        .quantize = { .max_colors = 32,
+                      .dither = { .method = GIF_DITHER_ERROR_DIFFUSION } },
+    };
+    gif_quantize_frames((const uint8_t* const*)frames, 4, &config);
+    /* Opaque frames keep a transparent index for the delta masking of
+       optimize. */
+    munit_assert_true(config.has_transparent_index);
+    munit_assert_uint8(config.transparent_index, <, 32);
+    munit_assert_uint8(config.metadata.gct_size_n, ==, 4);
+    GIFAnimationConfig plain = { .metadata = { .width = 64, .height = 64 },
+                                 .quantize = { .max_colors = 32 } };
+    gif_quantize_frames((const uint8_t* const*)frames, 4, &plain);
+    munit_assert_false(plain.has_transparent_index);
+    free(plain.color_table);
+    /* The caller's transparent index is kept, the colours going around it. */
+    plain.has_transparent_index = true;
+    plain.transparent_index = 0;
+    gif_quantize_frames((const uint8_t* const*)frames, 4, &plain);
+    munit_assert_true(plain.has_transparent_index);
+    munit_assert_uint8(plain.transparent_index, ==, 0);
+    GIFColor* first_table = plain.color_table;
+    plain.transparent_index = 3;
+    gif_quantize_frames((const uint8_t* const*)frames, 4, &plain);
+    munit_assert_uint8(plain.transparent_index, ==, 3);
+    munit_assert_uint8(
+      plain.metadata.gct_size_n, ==, config.metadata.gct_size_n);
+    munit_assert_memory_equal(
+      3 * sizeof(GIFColor), plain.color_table, first_table[1]);
+    munit_assert_memory_equal(
+      28 * sizeof(GIFColor), plain.color_table[4], first_table[4]);
+    free(first_table);
+    free(plain.color_table);
+
+    /* The diffused error of the moving square does not leak into the static
+       background, only the square itself is redrawn. */
+    GIFAnimation* animation =
+      gif_animation_begin(&config, "out/test_animation_global.gif");
+    gif_animation_add_frame_rgba(animation, frames[0], 10);
+    gif_animation_add_frame_rgba(animation, frames[1], 10);
+    gif_animation_end(animation);
+    free(config.color_table);
+
+    size_t size = 0;
+    uint8_t* file_data =
+      read_file_to_buffer("out/test_animation_global.gif", &size);
+    GIFMetadata read_metadata = { 0 };
+    size_t cursor = gif_read_header(file_data, &read_metadata.version);
+    cursor +=
+      gif_read_logical_screen_descriptor(file_data + cursor, &read_metadata);
+    cursor += 3 * (1 << (read_metadata.gct_size_n + 1)) + 19;
+    cursor += read_frame_descriptor(file_data + cursor, &read_metadata);
+    cursor += read_frame_descriptor(file_data + cursor, &read_metadata);
+    munit_assert_uint16(read_metadata.left, >=, 8);
+    munit_assert_uint16(read_metadata.width, <=, 12);
+    munit_assert_uint16(read_metadata.top, ==, 24);
+    munit_assert_uint16(read_metadata.height, ==, 8);
+    free(file_data);
+
+    /* Local palettes are kept while they fit and replaced on a scene
+       change. The first one doubles as the global color table. */
+    config.palette_mode = GIF_PALETTE_LOCAL;
+    config.color_table = NULL;
+    animation = gif_animation_begin(&config, "out/test_animation_local.gif");
+    for (int i = 0; i < 4; i++)
+        gif_animation_add_frame_rgba(animation, frames[i], 10);
+    gif_animation_end(animation);
+
+    file_data = read_file_to_buffer("out/test_animation_local.gif", &size);
+    cursor = gif_read_header(file_data, &read_metadata.version);
+    cursor +=
+      gif_read_logical_screen_descriptor(file_data + cursor, &read_metadata);
+    munit_assert_true(read_metadata.has_gct);
+    cursor += 3 * (1 << (read_metadata.gct_size_n + 1)) + 19;
+
+    const bool has_local_table[] = { false, false, true, true };
+    const uint16_t expected_width[] = { 64, 12, 64, 12 };
+    for (int i = 0; i < 4; i++) {
+        cursor += read_frame_descriptor(file_data + cursor, &read_metadata);
+        munit_assert_int(
+          (read_metadata.local_color_table & 0x80) != 0, ==, has_local_table[i]);
+        munit_assert_uint16(read_metadata.width, <=, expected_width[i]);
+    }
+    munit_assert_uint8(file_data[cursor], ==, 0x3b);
+    free(file_data);
+
+    /* Indexed frames start out with the configured table. */
+    const size_t indexed_amount = 61 * 47;
+    uint8_t* indexed = malloc(indexed_amount * 12);
+    GIFColor indexed_colors[16];
+    for (int i = 0; i < 16; i++) {
+        indexed_colors[i][0] = i * 16;
+        indexed_colors[i][1] = 255 - i * 16;
+        indexed_colors[i][2] = i * 5;
+    }
+    GIFAnimationConfig indexed_config = {
+        .metadata = { .width = 61, .height = 47, .gct_size_n = 3 },
+        .color_table = indexed_colors,
+        .lzw_hashmap_max_length = 4096,
+        .max_block_length = 254,
+        .optimize = true,
+        .palette_mode = GIF_PALETTE_LOCAL,
+    };
+    animation =
+      gif_animation_begin(&indexed_config, "out/test_animation_indexed.gif");
+    for (int f = 0; f < 12; f++) {
+        uint8_t* frame = indexed + f * indexed_amount;
+        for (size_t i = 0; i < indexed_amount; i++)
+            frame[i] = (i / 61 + i % 61 / 4 + (i % 61 > f * 4)) % 16;
+        gif_animation_add_frame(animation, frame, 10);
+    }
+    gif_animation_end(animation);
+
+    file_data = read_file_to_buffer("out/test_animation_indexed.gif", &size);
+    GIFProbeInfo info = { 0 };
+    munit_assert_true(gif_probe(file_data, size, &info));
+    munit_assert_size(info.frame_count, ==, 12);
+    /* The first frame, spliced behind the screen without the loop
+       extension, decodes to the first indices. */
+    const size_t screen_size = 13 + sizeof(indexed_colors);
+    const size_t frame_size =
+      read_frame_descriptor(file_data + screen_size + 19, &read_metadata);
+    uint8_t* first = malloc(screen_size + frame_size + 1);
+    memcpy(first, file_data, screen_size);
+    memcpy(first + screen_size, file_data + screen_size + 19, frame_size);
+    first[screen_size + frame_size] = 0x3b;
+    GIFObject imported = { 0 };
+    gif_import(first, &imported);
+    munit_assert_uint8(imported.metadata.gct_size_n, ==, 3);
+    munit_assert_memory_equal(
+      sizeof(indexed_colors), imported.color_table, indexed_colors);
+    munit_assert_memory_equal(indexed_amount, imported.indices, indexed);
+    free(imported.indices);
+    free(imported.color_table);
+    free(first);
+    free(file_data);
+    free(indexed);
+
+    for (int i = 0; i < 4; i++)
+        free(frames[i]);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_local_color_table(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    const uint16_t width = 40, height = 30;
+    const size_t pixel_amount = (size_t)width * height;
+    uint8_t* indices = malloc(pixel_amount);
+    for (size_t i = 0; i < pixel_amount; i++)
+        indices[i] = (i / 3 + i / width) % 8;
+    GIFColor colors[8];
+    for (int i = 0; i < 8; i++) {
+        colors[i][0] = i * 30;
+        colors[i][1] = 255 - i * 30;
+        colors[i][2] = i * 7;
+    }
+
+    /* Written with only a local table, right after the image descriptor. */
+    GIFMetadata metadata = (GIFMetadata){ .version = GIF89a,
+                                          .color_resolution = 2,
+                                          .min_code_size = 3,
+                                          .gct_size_n = 2,
+                                          .width = width,
+                                          .height = height,
+                                          .has_gct = true,
+                                          .local_color_table = 0x80 };
+    GIFObject gif_object = { .color_table = colors,
+                             .indices = indices,
+                             .metadata = metadata };
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254 };
+    gif_export_ex(gif_object, &options, "out/test_local_color_table.gif");
+
+    size_t size = 0;
+    uint8_t* bytes =
+      read_file_to_buffer("out/test_local_color_table.gif", &size);
+    munit_assert_uint8(bytes[10] & 0x80, ==, 0);
+    munit_assert_uint8(bytes[13], ==, ',');
+    munit_assert_uint8(bytes[22], ==, 0x82);
+    munit_assert_memory_equal(sizeof(colors), bytes + 23, colors);
+
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_uint8(imported.metadata.gct_size_n, ==, 2);
+    munit_assert_memory_equal(sizeof(colors), imported.color_table, colors);
+    munit_assert_memory_equal(pixel_amount, imported.indices, indices);
+    free(imported.indices);
+    free(imported.color_table);
+
+    /* Borrowed, the table is the one in the file. */
+    GIFImportOptions import_options = { .borrow_color_table = true };
+    GIFObject borrowed = { 0 };
+    gif_import_ex(bytes, &import_options, &borrowed);
+    munit_assert_ptr_equal(borrowed.color_table, bytes + 23);
+    munit_assert_memory_equal(pixel_amount, borrowed.indices, indices);
+    free(borrowed.indices);
+    free(bytes);
+
+    /* Per frame palettes of an animation: a palette set again is not
+       written again, a new one is written as a local table. */
+    GIFColor other[8];
+    for (int i = 0; i < 8; i++)
+        memset(other[i], 255 - i * 20, sizeof(GIFColor));
+    GIFAnimationConfig config = {
+        .metadata = { .width = width, .height = height },
+        .lzw_hashmap_max_length = 4096,
+        .max_block_length = 254,
+        .optimize = true,
+        .palette_mode = GIF_PALETTE_LOCAL,
+    };
+    GIFAnimation* animation =
+      gif_animation_begin(&config, "out/test_animation_palettes.gif");
+    gif_animation_set_palette(animation, colors, 2);
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_set_palette(animation, colors, 2);
+    indices[0] ^= 1;
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_set_palette(animation, other, 2);
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_end(animation);
+
+    bytes = read_file_to_buffer("out/test_animation_palettes.gif", &size);
+    GIFMetadata read_metadata = { 0 };
+    size_t cursor = gif_read_header(bytes, &read_metadata.version);
+    cursor += gif_read_logical_screen_descriptor(bytes + cursor, &read_metadata);
+    munit_assert_uint8(read_metadata.gct_size_n, ==, 2);
+    munit_assert_memory_equal(sizeof(colors), bytes + cursor, colors);
+    cursor += sizeof(colors) + 19;
+
+    const bool has_local_table[] = { false, false, true };
+    for (int i = 0; i < 3; i++) {
+        size_t frame = cursor;
+        cursor += read_frame_descriptor(bytes + cursor, &read_metadata);
+        munit_assert_int(
+          (read_metadata.local_color_table & 0x80) != 0, ==, has_local_table[i]);
+        if (has_local_table[i]) {
+            munit_assert_uint16(read_metadata.width, ==, width);
+            munit_assert_memory_equal(sizeof(other), bytes + frame + 18, other);
+        }
+    }
+    munit_assert_uint8(bytes[cursor], ==, 0x3b);
+    free(bytes);
+
+    /* Without a palette indexed frames are dropped, from the first one set
+       or config->color_table they are written. */
+    GIFProbeInfo info = { 0 };
+    animation = gif_animation_begin(&config, "out/test_animation_palettes.gif");
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_set_palette(animation, colors, 2);
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_end(animation);
+    bytes = read_file_to_buffer("out/test_animation_palettes.gif", &size);
+    munit_assert_true(gif_probe(bytes, size, &info));
+    munit_assert_size(info.frame_count, ==, 1);
+    free(bytes);
+
+    config.color_table = colors;
+    config.metadata.gct_size_n = 2;
+    animation = gif_animation_begin(&config, "out/test_animation_palettes.gif");
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_set_palette(animation, other, 2);
+    gif_animation_add_frame(animation, indices, 10);
+    gif_animation_end(animation);
+    bytes = read_file_to_buffer("out/test_animation_palettes.gif", &size);
+    munit_assert_true(gif_probe(bytes, size, &info));
+    munit_assert_size(info.frame_count, ==, 2);
+    cursor = gif_read_header(bytes, &read_metadata.version);
+    cursor += gif_read_logical_screen_descriptor(bytes + cursor, &read_metadata);
+    munit_assert_memory_equal(sizeof(colors), bytes + cursor, colors);
+    cursor += sizeof(colors) + 19;
+    for (int i = 0; i < 2; i++) {
+        cursor += read_frame_descriptor(bytes + cursor, &read_metadata);
+        munit_assert_int(
+          (read_metadata.local_color_table & 0x80) != 0, ==, i == 1);
+    }
+    free(bytes);
+    free(indices);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_probe(const MunitParameter params[], void* user_data_or_fixture)
+{
+    const uint16_t width = 24, height = 16;
+    uint8_t indices[24 * 16];
+    GIFColor colors[4] = { { 0, 0, 0 },
+                           { 255, 255, 255 },
+                           { 255, 0, 0 },
+                           { 0, 0, 255 } };
+    GIFAnimationConfig config = {
+        .metadata = { .width = width,
+                      .height = height,
+                      .has_gct = true,
+                      .gct_size_n = 1,
+                      .min_code_size = 2,
+                      .color_resolution = 1 },
+        .color_table = colors,
+        .loop_count = 5,
+        .lzw_hashmap_max_length = 4096,
+        .max_block_length = 254,
+    };
+    GIFAnimation* animation =
+      gif_animation_begin(&config, "out/test_probe.gif");
+    for (int frame = 0; frame < 3; frame++) {
+        for (size_t i = 0; i < sizeof(indices); i++)
+            indices[i] = (i / 5 + frame) % 4;
+        gif_animation_add_frame(animation, indices, (frame + 1) * 10);
+    }
+    gif_animation_end(animation);
+
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("out/test_probe.gif", &size);
+    GIFProbeInfo info = { 0 };
+    munit_assert_true(gif_probe(bytes, size, &info));
+    munit_assert_uint16(info.width, ==, width);
+    munit_assert_uint16(info.height, ==, height);
+    munit_assert_size(info.frame_count, ==, 3);
+    munit_assert_uint32(info.duration, ==, 60);
+    munit_assert_true(info.has_loop_count);
+    munit_assert_uint16(info.loop_count, ==, 5);
+
+    /* Truncated anywhere, the trailer is missing. */
+    munit_assert_false(gif_probe(bytes, size - 1, &info));
+    munit_assert_false(gif_probe(bytes, size / 2, &info));
+    free(bytes);
+
+    bytes = read_file_to_buffer("test/test-images/cat256.gif", &size);
+    munit_assert_true(gif_probe(bytes, size, &info));
+    munit_assert_size(info.frame_count, ==, 1);
+    munit_assert_false(info.has_loop_count);
+    GIFObject imported = { 0 };
+    gif_import(bytes, &imported);
+    munit_assert_uint16(info.width, ==, imported.metadata.width);
+    munit_assert_uint16(info.height, ==, imported.metadata.height);
+    free(imported.indices);
+    free(imported.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+/* Whether downscaled holds the middle index of every block of full. */
+static bool
+samples_full(const GIFObject* full, const GIFObject* downscaled, int scale)
+{
+    const uint16_t width = full->metadata.width;
+    const uint16_t height = full->metadata.height;
+    if (downscaled->metadata.width != (width + scale - 1) / scale ||
+        downscaled->metadata.height != (height + scale - 1) / scale)
+        return false;
+    for (size_t y = 0; y < downscaled->metadata.height; y++) {
+        size_t source_y = y * scale + scale / 2;
+        source_y = source_y < height ? source_y : height - 1;
+        for (size_t x = 0; x < downscaled->metadata.width; x++) {
+            size_t source_x = x * scale + scale / 2;
+            source_x = source_x < width ? source_x : width - 1;
+            if (downscaled->indices[y * downscaled->metadata.width + x] !=
+                full->indices[source_y * width + source_x])
+                return false;
+        }
+    }
+    return true;
+}
+
+static MunitResult
+test_decode_downscaled(const MunitParameter params[],
+                       void* user_data_or_fixture)
+{
+    const char* paths[] = { "test/test-images/cat256.gif",
+                            "test/test-images/woman256.gif",
+                            "test/test-images/bird512.gif",
+                            "out/test_downscaled.gif" };
+
+    /* An odd sized interlaced image, so that blocks are cut off at the
+       edges and rows arrive out of order. */
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer(paths[1], &size);
+    GIFObject source = { 0 };
+    gif_import(bytes, &source);
+    free(bytes);
+    source.metadata.width -= 3;
+    source.metadata.height -= 5;
+    for (size_t y = 0; y < source.metadata.height; y++)
+        memmove(source.indices + y * source.metadata.width,
+                source.indices + y * (source.metadata.width + 3),
+                source.metadata.width);
+    GIFExportOptions export_options = { .lzw_hashmap_max_length = 4096,
+                                        .max_block_length = 254,
+                                        .interlace = true };
+    gif_export_ex(source, &export_options, paths[3]);
+    free(source.indices);
+    free(source.color_table);
+
+    for (size_t p = 0; p < sizeof(paths) / sizeof(paths[0]); p++) {
+        bytes = read_file_to_buffer(paths[p], &size);
+        GIFObject full = { 0 };
+        gif_import(bytes, &full);
+        for (int scale = 2; scale <= 8; scale *= 2) {
+            GIFImportOptions options = { .downscale = scale };
+            GIFObject downscaled = { 0 };
+            gif_import_ex(bytes, &options, &downscaled);
+            munit_assert_true(samples_full(&full, &downscaled, scale));
+            free(downscaled.indices);
+            free(downscaled.color_table);
+        }
+        free(full.indices);
+        free(full.color_table);
+        free(bytes);
+    }
+
+    return MUNIT_OK;
+}
+
+static void
+count_passes(const GIFObject* gif_object,
+             uint8_t pass,
+             uint8_t pass_count,
+             void* user_data)
+{
+    (*(int*)user_data)++;
+}
+
+static MunitResult
+test_decode_region(const MunitParameter params[], void* user_data_or_fixture)
+{
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/bird512.gif", &size);
+    GIFObject full = { 0 };
+    gif_import(bytes, &full);
+    GIFExportOptions export_options = { .lzw_hashmap_max_length = 4096,
+                                        .max_block_length = 254,
+                                        .interlace = true };
+    gif_export_ex(full, &export_options, "out/test_region.gif");
+    size_t interlaced_size = 0;
+    uint8_t* interlaced =
+      read_file_to_buffer("out/test_region.gif", &interlaced_size);
+
+    /* The last one reaches past the image and is cut to it. */
+    const GIFRect regions[] = { { 0, 0, 512, 1 },
+                                { 100, 37, 61, 90 },
+                                { 0, 300, 512, 212 },
+                                { 450, 480, 100, 100 } };
+    const uint8_t* files[] = { bytes, interlaced };
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+        for (int f = 0; f < 2; f++) {
+            GIFImportOptions options = { .region = regions[r] };
+            GIFObject region = { 0 };
+            gif_import_ex(files[f], &options, &region);
+            munit_assert_uint16(region.metadata.left, ==, regions[r].left);
+            munit_assert_uint16(region.metadata.top, ==, regions[r].top);
+            munit_assert_uint16(region.metadata.width,
+                                ==,
+                                r == 3 ? 62 : regions[r].width);
+            for (size_t y = 0; y < region.metadata.height; y++)
+                munit_assert_memory_equal(
+                  region.metadata.width,
+                  region.indices + y * region.metadata.width,
+                  full.indices + (regions[r].top + y) * 512 + regions[r].left);
+            free(region.indices);
+            free(region.color_table);
+        }
+    }
+
+    /* Downscaled within the region. */
+    GIFImportOptions options = { .region = { 64, 64, 256, 128 },
+                                 .downscale = 4 };
+    GIFObject region = { 0 };
+    gif_import_ex(bytes, &options, &region);
+    munit_assert_uint16(region.metadata.width, ==, 64);
+    munit_assert_uint16(region.metadata.height, ==, 32);
+    for (size_t y = 0; y < 32; y++) {
+        for (size_t x = 0; x < 64; x++)
+            munit_assert_uint8(region.indices[y * 64 + x],
+                               ==,
+                               full.indices[(64 + y * 4 + 2) * 512 + 64 +
+                                            x * 4 + 2]);
+    }
+    free(region.indices);
+    free(region.color_table);
+
+    /* The decode stops after the region, before the image is complete. */
+    int passes = 0;
+    options = (GIFImportOptions){ .region = { 0, 0, 512, 100 },
+                                  .progress = count_passes,
+                                  .user_data = &passes };
+    gif_import_ex(bytes, &options, &region);
+    munit_assert_int(passes, ==, 0);
+    free(region.indices);
+    free(region.color_table);
+    options.region.height = 0;
+    gif_import_ex(bytes, &options, &region);
+    munit_assert_int(passes, ==, 1);
+    free(region.indices);
+    free(region.color_table);
+
+    free(full.indices);
+    free(full.color_table);
+    free(interlaced);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+/* Decodes into the middle of a larger canvas and checks that the bytes
+   around the image stay untouched. */
+static MunitResult
+test_decode_into_buffer(const MunitParameter params[],
+                        void* user_data_or_fixture)
+{
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/cat64.gif", &size);
+    GIFObject full = { 0 };
+    gif_import(bytes, &full);
+
+    const GIFPixelFormat formats[] = { GIF_PIXEL_INDEX,
+                                       GIF_PIXEL_RGBA,
+                                       GIF_PIXEL_BGRA };
+    for (int f = 0; f < 3; f++) {
+        const size_t depth = formats[f] == GIF_PIXEL_INDEX ? 1 : 4;
+        const size_t stride = 100 * depth;
+        uint8_t* canvas = malloc(stride * 80);
+        memset(canvas, 0xab, stride * 80);
+        GIFPixelBuffer buffer = { .pixels = canvas + 8 * stride + 16 * depth,
+                                  .stride = stride,
+                                  .format = formats[f] };
+        GIFObject into = { 0 };
+        gif_import_into(bytes, NULL, &buffer, &into);
+        munit_assert_null(into.indices);
+        munit_assert_uint16(into.metadata.width, ==, 64);
+
+        for (size_t y = 0; y < 80; y++) {
+            for (size_t x = 0; x < 100; x++) {
+                const uint8_t* pixel = canvas + y * stride + x * depth;
+                if (y < 8 || y >= 72 || x < 16 || x >= 80) {
+                    munit_assert_uint8(pixel[0], ==, 0xab);
+                    continue;
+                }
+                uint8_t index = full.indices[(y - 8) * 64 + x - 16];
+                if (depth == 1) {
+                    munit_assert_uint8(pixel[0], ==, index);
+                    continue;
+                }
+                const uint8_t* color = full.color_table[index];
+                int red = formats[f] == GIF_PIXEL_RGBA ? 0 : 2;
+                munit_assert_uint8(pixel[red], ==, color[0]);
+                munit_assert_uint8(pixel[1], ==, color[1]);
+                munit_assert_uint8(pixel[2 - red], ==, color[2]);
+                munit_assert_uint8(pixel[3], ==, index == 0x1f ? 0 : 255);
+            }
+        }
+        free(into.color_table);
+        free(canvas);
+    }
+
+    /* Downscaled into a dense buffer, as the options give its size. */
+    GIFImportOptions options = { .downscale = 2 };
+    uint8_t* indices = malloc(32 * 32);
+    GIFPixelBuffer buffer = { .pixels = indices,
+                              .stride = 32,
+                              .format = GIF_PIXEL_INDEX };
+    GIFObject into = { 0 };
+    gif_import_into(bytes, &options, &buffer, &into);
+    GIFObject downscaled = { 0 };
+    gif_import_ex(bytes, &options, &downscaled);
+    munit_assert_memory_equal(32 * 32, indices, downscaled.indices);
+    free(downscaled.indices);
+    free(downscaled.color_table);
+    free(into.color_table);
+    free(indices);
+
+    free(full.indices);
+    free(full.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+/* Exports gif_object from indices packed in format and from the bytes, which
+   have to give the same file. */
+static void
+check_packed_export(GIFObject gif_object,
+                    GIFPixelFormat format,
+                    const GIFExportOptions* options)
+{
+    const uint16_t width = gif_object.metadata.width;
+    const size_t stride = gif_row_bytes(width, format);
+    uint8_t* packed = malloc(stride * gif_object.metadata.height);
+    for (size_t y = 0; y < gif_object.metadata.height; y++)
+        gif_pack_indices(
+          gif_object.indices + y * width, width, format, packed + y * stride);
+    gif_export_ex(gif_object, options, "out/test_packed.gif");
+
+    GIFExportOptions packed_options = *options;
+    packed_options.index_format = format;
+    gif_object.indices = packed;
+    gif_export_ex(gif_object, &packed_options, "out/test_packed_in.gif");
+    assert_binary_files_equal("out/test_packed_in.gif", "out/test_packed.gif");
+    free(packed);
+}
+
+static MunitResult
+test_packed_indices(const MunitParameter params[], void* user_data_or_fixture)
+{
+    /* Every length up to past the 64 indices of a vector. */
+    uint8_t indices[150];
+    uint8_t packed[150];
+    uint8_t unpacked[150];
+    for (size_t i = 0; i < sizeof(indices); i++)
+        indices[i] = (i * 7 + i / 3) & 0xf;
+    for (size_t n = 0; n <= sizeof(indices); n++) {
+        memset(packed, 0xff, sizeof(packed));
+        gif_pack_indices(indices, n, GIF_PIXEL_INDEX4, packed);
+        munit_assert_size(gif_row_bytes(n, GIF_PIXEL_INDEX4), ==, (n + 1) / 2);
+        for (size_t i = 0; i < n; i++)
+            munit_assert_uint8(
+              (packed[i / 2] >> (i % 2 ? 0 : 4)) & 0xf, ==, indices[i]);
+        if (n % 2)
+            munit_assert_uint8(packed[n / 2] & 0xf, ==, 0);
+        munit_assert_uint8(packed[(n + 1) / 2], ==, 0xff);
+        gif_unpack_indices(packed, n, GIF_PIXEL_INDEX4, unpacked);
+        munit_assert_memory_equal(n, unpacked, indices);
+
+        gif_pack_indices(indices, n, GIF_PIXEL_INDEX2, packed);
+        gif_unpack_indices(packed, n, GIF_PIXEL_INDEX2, unpacked);
+        for (size_t i = 0; i < n; i++) {
+            munit_assert_uint8(
+              (packed[i / 4] >> (6 - i % 4 * 2)) & 0x3, ==, indices[i] & 0x3);
+            munit_assert_uint8(unpacked[i], ==, indices[i] & 0x3);
+        }
+    }
+
+    /* cat16 decoded into nibbles, rows padded apart. */
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/cat16.gif", &size);
+    GIFObject full = { 0 };
+    gif_import(bytes, &full);
+    const size_t stride = 12;
+    uint8_t* nibbles = malloc(stride * 16);
+    memset(nibbles, 0xab, stride * 16);
+    GIFPixelBuffer buffer = { .pixels = nibbles,
+                              .stride = stride,
+                              .format = GIF_PIXEL_INDEX4 };
+    GIFObject into = { 0 };
+    gif_import_into(bytes, NULL, &buffer, &into);
+    for (size_t y = 0; y < 16; y++) {
+        gif_unpack_indices(
+          nibbles + y * stride, 16, GIF_PIXEL_INDEX4, unpacked);
+        munit_assert_memory_equal(16, unpacked, full.indices + y * 16);
+        munit_assert_uint8(nibbles[y * stride + 8], ==, 0xab);
+    }
+    free(into.color_table);
+
+    /* 16 colours do not fit two bits, nothing is written. */
+    memset(nibbles, 0xab, stride * 16);
+    buffer.format = GIF_PIXEL_INDEX2;
+    gif_import_into(bytes, NULL, &buffer, &into);
+    munit_assert_uint8(nibbles[0], ==, 0xab);
+    free(into.color_table);
+    free(nibbles);
+
+    GIFExportOptions options = { .lzw_hashmap_max_length = 4096,
+                                 .max_block_length = 254 };
+    check_packed_export(full, GIF_PIXEL_INDEX4, &options);
+    options.interlace = true;
+    check_packed_export(full, GIF_PIXEL_INDEX4, &options);
+    options = (GIFExportOptions){ .lzw_hashmap_max_length = 4096,
+                                  .max_block_length = 254,
+                                  .minimize_palette = true,
+                                  .effort = GIF_EFFORT_MAX };
+    check_packed_export(full, GIF_PIXEL_INDEX4, &options);
+
+    /* Four colours, a width that leaves part of the last byte. */
+    GIFColor colors[4] = {
+        { 0, 0, 0 }, { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }
+    };
+    uint8_t* crumbs = malloc(37 * 23);
+    for (size_t i = 0; i < 37 * 23; i++)
+        crumbs[i] = (i / 5 + i / 37) & 0x3;
+    GIFObject four = { .metadata = { .version = GIF89a,
+                                     .width = 37,
+                                     .height = 23,
+                                     .has_gct = true,
+                                     .gct_size_n = 1,
+                                     .min_code_size = 2 },
+                       .color_table = colors,
+                       .indices = crumbs };
+    options = (GIFExportOptions){ .lzw_hashmap_max_length = 4096,
+                                  .max_block_length = 254 };
+    check_packed_export(four, GIF_PIXEL_INDEX2, &options);
+
+    uint8_t* file = read_file_to_buffer("out/test_packed.gif", &size);
+    uint8_t two_bit[10 * 23];
+    buffer = (GIFPixelBuffer){ .pixels = two_bit,
+                               .stride = 10,
+                               .format = GIF_PIXEL_INDEX2 };
+    gif_import_into(file, NULL, &buffer, &into);
+    for (size_t y = 0; y < 23; y++) {
+        gif_unpack_indices(two_bit + y * 10, 37, GIF_PIXEL_INDEX2, unpacked);
+        munit_assert_memory_equal(37, unpacked, crumbs + y * 37);
+    }
+    free(into.color_table);
+    free(file);
+    free(crumbs);
+
+    free(full.indices);
+    free(full.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_export_view(const MunitParameter params[], void* user_data_or_fixture)
+{
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/bird512.gif", &size);
+    GIFObject full = { 0 };
+    gif_import(bytes, &full);
+
+    /* A part of the image, exported in place and from a copy. */
+    const GIFRect rect = { 100, 37, 61, 90 };
+    GIFObject view = full;
+    view.metadata.width = rect.width;
+    view.metadata.height = rect.height;
+    view.indices = full.indices + rect.top * 512 + rect.left;
+    view.stride = 512;
+    GIFObject copy = view;
+    copy.indices = malloc(rect.width * rect.height);
+    copy.stride = 0;
+    for (size_t y = 0; y < rect.height; y++)
+        memcpy(copy.indices + y * rect.width,
+               view.indices + y * view.stride,
+               rect.width);
+
+    const GIFExportOptions options[] = {
+        { .lzw_hashmap_max_length = 4096, .max_block_length = 254 },
+        { .lzw_hashmap_max_length = 4096,
+          .max_block_length = 254,
+          .interlace = true },
+        { .lzw_hashmap_max_length = 4096,
+          .max_block_length = 254,
+          .clear_strategy = GIF_CLEAR_ADAPTIVE,
+          .lossy = 16 },
+        { .lzw_hashmap_max_length = 4096,
+          .max_block_length = 254,
+          .minimize_palette = true,
+          .effort = GIF_EFFORT_MAX },
+    };
+    for (size_t o = 0; o < sizeof(options) / sizeof(options[0]); o++) {
+        gif_export_ex(view, &options[o], "out/test_view.gif");
+        gif_export_ex(copy, &options[o], "out/test_view_copy.gif");
+        assert_binary_files_equal("out/test_view.gif",
+                                  "out/test_view_copy.gif");
+    }
+    free(copy.indices);
+    free(full.indices);
+    free(full.color_table);
+    free(bytes);
+
+    /* Packed rows further apart than their length. */
+    bytes = read_file_to_buffer("test/test-images/cat16.gif", &size);
+    gif_import(bytes, &full);
+    uint8_t nibbles[12 * 16];
+    GIFPixelBuffer buffer = { .pixels = nibbles,
+                              .stride = 12,
+                              .format = GIF_PIXEL_INDEX4 };
+    GIFObject packed = { 0 };
+    gif_import_into(bytes, NULL, &buffer, &packed);
+    packed.indices = nibbles;
+    packed.stride = 12;
+    GIFExportOptions packed_options = options[0];
+    packed_options.index_format = GIF_PIXEL_INDEX4;
+    gif_export_ex(packed, &packed_options, "out/test_view.gif");
+    gif_export_ex(full, &options[0], "out/test_view_copy.gif");
+    assert_binary_files_equal("out/test_view.gif", "out/test_view_copy.gif");
+    free(packed.color_table);
+    free(full.indices);
+    free(full.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_index_transforms(const MunitParameter params[],
+                      void* user_data_or_fixture)
+{
+    /* Sizes around the 8 pixel blocks and 64 pixel tiles, rows padded. */
+    const uint16_t sizes[][2] = {
+        { 1, 1 }, { 8, 8 }, { 37, 23 }, { 133, 70 }
+    };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const uint16_t width = sizes[s][0];
+        const uint16_t height = sizes[s][1];
+        const size_t stride = width + 5;
+        const size_t side = (width > height ? width : height) + 3;
+        uint8_t* src = malloc(stride * height);
+        uint8_t* dst = malloc(side * side);
+        uint8_t* back = malloc(stride * height);
+        for (size_t i = 0; i < stride * height; i++)
+            src[i] = (i * 131 + i / 7) & 0xff;
+
+        gif_indices_flip(src,
+                         stride,
+                         width,
+                         height,
+                         GIF_FLIP_HORIZONTAL,
+                         dst,
+                         side);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++)
+                munit_assert_uint8(dst[y * side + width - 1 - x],
+                                   ==,
+                                   src[y * stride + x]);
+        }
+        gif_indices_flip(src,
+                         stride,
+                         width,
+                         height,
+                         GIF_FLIP_VERTICAL,
+                         dst,
+                         side);
+        for (size_t y = 0; y < height; y++)
+            munit_assert_memory_equal(
+              width, dst + (height - 1 - y) * side, src + y * stride);
+
+        gif_indices_rotate(src,
+                           stride,
+                           width,
+                           height,
+                           GIF_ROTATE_90,
+                           dst,
+                           side);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++)
+                munit_assert_uint8(dst[x * side + height - 1 - y],
+                                   ==,
+                                   src[y * stride + x]);
+        }
+        /* A quarter turn back gives the image again. */
+        gif_indices_rotate(dst,
+                           side,
+                           height,
+                           width,
+                           GIF_ROTATE_270,
+                           back,
+                           stride);
+        for (size_t y = 0; y < height; y++)
+            munit_assert_memory_equal(
+              width, back + y * stride, src + y * stride);
+
+        gif_indices_rotate(src,
+                           stride,
+                           width,
+                           height,
+                           GIF_ROTATE_180,
+                           dst,
+                           side);
+        for (size_t y = 0; y < height; y++) {
+            for (size_t x = 0; x < width; x++)
+                munit_assert_uint8(
+                  dst[(height - 1 - y) * side + width - 1 - x],
+                  ==,
+                  src[y * stride + x]);
+        }
+
+        /* Twice the size and back to it. */
+        uint8_t* large = malloc((size_t)width * height * 4);
+        gif_indices_resize(
+          src, stride, width, height, large, width * 2, width * 2, height * 2);
+        for (size_t y = 0; y < height * 2u; y++) {
+            for (size_t x = 0; x < width * 2u; x++)
+                munit_assert_uint8(large[y * width * 2 + x],
+                                   ==,
+                                   src[y / 2 * stride + x / 2]);
+        }
+        gif_indices_resize(
+          large, width * 2, width * 2, height * 2, back, stride, width, height);
+        for (size_t y = 0; y < height; y++)
+            munit_assert_memory_equal(
+              width, back + y * stride, src + y * stride);
+
+        free(large);
+        free(back);
+        free(dst);
+        free(src);
+    }
+
+    /* A crop is a view of the indices, which export reads in place. */
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/cat64.gif", &size);
+    GIFObject full = { 0 };
+    gif_import(bytes, &full);
+    GIFObject crop = gif_crop(&full, (GIFRect){ 60, 10, 20, 30 });
+    munit_assert_uint16(crop.metadata.width, ==, 4);
+    munit_assert_uint16(crop.metadata.height, ==, 30);
+    munit_assert_ptr_equal(crop.indices, full.indices + 10 * 64 + 60);
+    munit_assert_size(crop.stride, ==, 64);
+    GIFObject inner = gif_crop(&crop, (GIFRect){ 1, 2, 2, 2 });
+    munit_assert_ptr_equal(inner.indices, full.indices + 12 * 64 + 61);
+    free(full.indices);
+    free(full.color_table);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_resample(const MunitParameter params[], void* user_data_or_fixture)
+{
+    const GIFFilter filters[] = { GIF_FILTER_BOX,
+                                  GIF_FILTER_BILINEAR,
+                                  GIF_FILTER_LANCZOS3 };
+    const size_t stride = 37 * 4 + 12;
+    uint8_t* src = malloc(stride * 23);
+    uint8_t* dst = malloc(stride * 23);
+    for (size_t f = 0; f < 3; f++) {
+        GIFResampleOptions options = { .filter = filters[f] };
+
+        /* The same size gives the same pixels. */
+        for (size_t i = 0; i < stride * 23; i++)
+            src[i] = i % 4 == 3 ? 255 : (i * 131 + i / 7) & 0xff;
+        gif_resample_rgba(src, stride, 37, 23, dst, stride, 37, 23, &options);
+        for (size_t y = 0; y < 23; y++)
+            munit_assert_memory_equal(
+              37 * 4, dst + y * stride, src + y * stride);
+
+        /* Flat colour stays flat, enlarged and reduced. */
+        for (size_t i = 0; i < stride * 23; i++)
+            src[i] = (uint8_t[]){ 200, 10, 90, 255 }[i % 4];
+        const uint16_t sizes[][2] = { { 13, 5 }, { 36, 23 }, { 10, 9 } };
+        for (size_t s = 0; s < 3; s++) {
+            gif_resample_rgba(src,
+                              stride,
+                              sizes[s][0],
+                              sizes[s][1],
+                              dst,
+                              stride,
+                              37,
+                              23,
+                              &options);
+            for (size_t y = 0; y < 23; y++)
+                munit_assert_memory_equal(
+                  37 * 4, dst + y * stride, src + y * stride);
+        }
+
+        /* Transparent red next to blue, the red does not bleed in. */
+        for (size_t y = 0; y < 23; y++) {
+            for (size_t x = 0; x < 37; x++) {
+                uint8_t* pixel = src + y * stride + x * 4;
+                const bool blue = x > 15;
+                pixel[0] = blue ? 0 : 255;
+                pixel[1] = 0;
+                pixel[2] = blue ? 255 : 0;
+                pixel[3] = blue ? 255 : 0;
+            }
+        }
+        gif_resample_rgba(src, stride, 37, 23, dst, 13 * 4, 13, 7, &options);
+        for (size_t i = 0; i < 13 * 7; i++) {
+            if (dst[i * 4 + 3] > 0)
+                munit_assert_uint8(dst[i * 4], ==, 0);
+        }
+    }
+
+    /* Box reduction by two is the mean of every 2 by 2 block. */
+    for (size_t i = 0; i < stride * 23; i++)
+        src[i] = i % 4 == 3 ? 255 : (i * 131 + i / 7) & 0xff;
+    GIFResampleOptions options = { .filter = GIF_FILTER_BOX };
+    gif_resample_rgba(src, stride, 36, 22, dst, 18 * 4, 18, 11, &options);
+    for (size_t y = 0; y < 11; y++) {
+        for (size_t x = 0; x < 18; x++) {
+            for (size_t c = 0; c < 4; c++) {
+                const uint8_t* block = src + y * 2 * stride + x * 8 + c;
+                int mean = (block[0] + block[4] + block[stride] +
+                            block[stride + 4] + 2) /
+                           4;
+                munit_assert_int(
+                  abs(dst[(y * 18 + x) * 4 + c] - mean), <=, 1);
+            }
+        }
+    }
+    free(dst);
+    free(src);
+
+    /* Decode to RGBA, resize on one thread and on several, quantise. */
+    size_t size = 0;
+    uint8_t* bytes = read_file_to_buffer("test/test-images/bird512.gif", &size);
+    uint8_t* rgba = malloc(512 * 512 * 4);
+    GIFPixelBuffer buffer = { .pixels = rgba,
+                              .stride = 512 * 4,
+                              .format = GIF_PIXEL_RGBA };
+    GIFObject full = { 0 };
+    gif_import_into(bytes, NULL, &buffer, &full);
+    uint8_t* single = malloc(200 * 150 * 4);
+    uint8_t* threaded = malloc(200 * 150 * 4);
+    options = (GIFResampleOptions){ .filter = GIF_FILTER_LANCZOS3,
+                                    .thread_count = 1 };
+    gif_resample_rgba(
+      rgba, 512 * 4, 512, 512, single, 200 * 4, 200, 150, &options);
+    options.thread_count = 4;
+    gif_resample_rgba(
+      rgba, 512 * 4, 512, 512, threaded, 200 * 4, 200, 150, &options);
+    munit_assert_memory_equal(200 * 150 * 4, single, threaded);
+
+    GIFQuantizeOptions quantize_options = { .max_colors = 256 };
+    GIFObject thumbnail = { 0 };
+    gif_quantize(single, 200, 150, &quantize_options, &thumbnail);
+    GIFExportOptions export_options = { .lzw_hashmap_max_length = 4096,
+                                        .max_block_length = 254 };
+    GIFExportStats stats =
+      gif_export_ex(thumbnail, &export_options, "out/test_resample.gif");
+    munit_assert_size(stats.compressed_size, >, 0);
+
+    free(thumbnail.indices);
+    free(thumbnail.color_table);
+    free(threaded);
+    free(single);
+    free(full.color_table);
+    free(rgba);
+    free(bytes);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_quantize(const MunitParameter params[], void* user_data_or_fixture)
+{
+    const size_t pixel_amount = 256 * 256;
+    uint8_t* rgba = malloc(pixel_amount * 4);
+    for (size_t i = 0; i < pixel_amount; i++) {
+        uint8_t x = i % 256, y = i / 256;
+        rgba[i * 4 + 0] = x;
+        rgba[i * 4 + 1] = y;
+        rgba[i * 4 + 2] = (x ^ y) & 0xc0;
+        rgba[i * 4 + 3] = 255;
+    }
+
+    GIFQuantizeOptions options = { .max_colors = 64 };
+    GIFObject median_cut = { 0 };
+    gif_quantize(rgba, 256, 256, &options, &median_cut);
+    munit_assert_uint8(median_cut.metadata.gct_size_n, ==, 5);
+    munit_assert_uint8(median_cut.metadata.min_code_size, ==, 6);
+    munit_assert_false(median_cut.graphic_control.transparent_color_flag);
+
+    options.refine = true;
+    GIFObject refined = { 0 };
+    gif_quantize(rgba, 256, 256, &options, &refined);
+
+    double median_cut_error = quantize_error(rgba, &median_cut);
+    double refined_error = quantize_error(rgba, &refined);
+    munit_assert_double(median_cut_error, <, 12.0);
+    munit_assert_double(refined_error, <=, median_cut_error);
+
+    /* Transparent pixels get an index of their own. */
+    for (int y = 0; y < 32; y++) {
+        for (int x = 0; x < 32; x++) {
+            rgba[(y * 256 + x) * 4 + 3] = 0;
+        }
+    }
+    GIFObject transparent = { 0 };
+    gif_quantize(rgba, 256, 256, &options, &transparent);
+    munit_assert_true(transparent.graphic_control.transparent_color_flag);
+    munit_assert_true(transparent.metadata.has_graphic_control);
+    uint8_t transparent_index =
+      transparent.graphic_control.transparent_color_index;
+    munit_assert_uint8(transparent_index, ==, 63);
+    for (size_t i = 0; i < pixel_amount; i++) {
+        bool is_transparent = (i / 256) < 32 && (i % 256) < 32;
+        munit_assert_int(
+          transparent.indices[i] == transparent_index, ==, is_transparent);
+    }
+    gif_export(transparent, 4096, 254, "out/test_quantize.gif");
+
+    free(median_cut.color_table);
+    free(median_cut.indices);
+    free(refined.color_table);
+    free(refined.indices);
+    free(transparent.color_table);
+    free(transparent.indices);
+    free(rgba);
+
+    return MUNIT_OK;
+}
+
+static MunitResult
+test_palette_mapper(const MunitParameter params[], void* user_data_or_fixture)
+{
+    GIFPaletteMapperOptions options = { .distance = GIF_DISTANCE_RGB,
+                                        .has_transparent_index = true,
+                                        .transparent_index = 0 };
+    GIFPaletteMapper* mapper =
+      gif_palette_mapper_create(woman256_colors, 256, &options);
+
+    /* Cell centres of the lookup cube map to the exact nearest entry. */
+    for (int r = 4; r < 256; r += 24) {
+        for (int g = 4; g < 256; g += 16) {
+            for (int b = 4; b < 256; b += 40) {
+                uint8_t index = gif_palette_mapper_map_color(mapper, r, g, b);
+                munit_assert_uint8(index, !=, 0);
+
+                int best_distance = 1 << 30;
+                for (int i = 1; i < 256; i++) {
+                    int dr = r - woman256_colors[i][0];
+                    int dg = g - woman256_colors[i][1];
+                    int db = b - woman256_colors[i][2];
+                    int distance = dr * dr + dg * dg + db * db;
+                    if (distance < best_distance)
+                        best_distance = distance;
+                }
+                int dr = r - woman256_colors[index][0];
+                int dg = g - woman256_colors[index][1];
+                int db = b - woman256_colors[index][2];
+                munit_assert_int(dr * dr + dg * dg + db * db, ==, best_distance);
+            }
+        }
+    }
+
+    uint8_t rgba[] = { 255, 255, 255, 255, 0, 0, 0, 0, 10, 20, 30, 255 };
+    uint8_t indices[3];
+    gif_palette_mapper_map(mapper, rgba, 3, indices);
+    munit_assert_uint8(indices[0], ==, gif_palette_mapper_map_color(mapper, 255, 255, 255));
+    munit_assert_uint8(indices[1], ==, 0);
+    munit_assert_uint8(indices[2], ==, gif_palette_mapper_map_color(mapper, 10, 20, 30));
+    gif_palette_mapper_destroy(mapper);
+
+    GIFColor primaries[] = { { 0, 0, 0 },     { 0, 0, 0 },   { 255, 255, 255 },
+                             { 255, 0, 0 },   { 0, 255, 0 }, { 0, 0, 255 } };
+    options.distance = GIF_DISTANCE_LAB;
+    mapper = gif_palette_mapper_create(primaries, 6, &options);
+    munit_assert_uint8(gif_palette_mapper_map_color(mapper, 20, 10, 10), ==, 1);
+    munit_assert_uint8(gif_palette_mapper_map_color(mapper, 240, 250, 245), ==, 2);
+    munit_assert_uint8(gif_palette_mapper_map_color(mapper, 230, 30, 20), ==, 3);
+    munit_assert_uint8(gif_palette_mapper_map_color(mapper, 40, 220, 60), ==, 4);
+    munit_assert_uint8(gif_palette_mapper_map_color(mapper, 10, 40, 200), ==, 5);
+    gif_palette_mapper_destroy(mapper);
+
+    return MUNIT_OK;
+}
+
+/* Mean absolute error of the average colour of 8x8 blocks, i.e. of what is
+   seen from a distance. */
+static double
+dither_block_error(const uint8_t* rgba,
+                   const uint8_t* indices,
+                   const GIFColor* colors,
+                   int width,
+                   int height)
+{
+    double error = 0;
+    for (int by = 0; by < height; by += 8) {
+        for (int bx = 0; bx < width; bx += 8) {
+            int expected = 0, actual = 0;
+            for (int y = by; y < by + 8; y++) {
+                for (int x = bx; x < bx + 8; x++) {
+                    expected += rgba[(y * width + x) * 4];
+                    actual += colors[indices[y * width + x]][0];
+                }
+            }
+            error += abs(expected - actual) / 64.0;
+        }
+    }
+    return error / ((width / 8) * (height / 8));
+}
+
+static MunitResult
+test_dither(const MunitParameter params[], void* user_data_or_fixture)
+{
+    const int width = 256, height = 64;
+    uint8_t* rgba = malloc(width * height * 4);
+    for (int i = 0; i < width * height; i++) {
+        memset(rgba + i * 4, i % width, 3);
+        rgba[i * 4 + 3] = 255;
+    }
+    GIFColor colors[] = { { 0, 0, 0 }, { 255, 255, 255 } };
+    GIFPaletteMapperOptions mapper_options = { .thread_count = 1 };
+    GIFPaletteMapper* mapper =
+      gif_palette_mapper_create(colors, 2, &mapper_options);
+
+    uint8_t* plain = malloc(width * height);
+    uint8_t* ordered = malloc(width * height);
+    uint8_t* diffused = malloc(width * height);
+    GIFDitherOptions options = { .method = GIF_DITHER_NONE };
+    gif_dither(mapper, rgba, width, height, &options, plain);
+    options.method = GIF_DITHER_ORDERED;
+    gif_dither(mapper, rgba, width, height, &options, ordered);
+    options.method = GIF_DITHER_ERROR_DIFFUSION;
+    gif_dither(mapper, rgba, width, height, &options, diffused);
+
+    double plain_error =
+      dither_block_error(rgba, plain, colors, width, height);
+    munit_assert_double(plain_error, >, 50.0);
+    munit_assert_double(
+      dither_block_error(rgba, ordered, colors, width, height), <, 10.0);
+    munit_assert_double(
+      dither_block_error(rgba, diffused, colors, width, height), <, 10.0);
+
+    /* The ordered pattern repeats every 8 rows. */
+    munit_assert_memory_equal(width * 8, ordered, ordered + width * 8);
+
+    /* The wavefront gives the same result regardless of the thread count. */
+    gif_palette_mapper_destroy(mapper);
+    mapper_options.thread_count = 4;
+    mapper = gif_palette_mapper_create(colors, 2, &mapper_options);
+    uint8_t* threaded = malloc(width * height);
+    gif_dither(mapper, rgba, width, height, &options, threaded);
+    munit_assert_memory_equal(width * height, diffused, threaded);
+
+    /* Lower strength leaves more flat runs behind. */
+    options.strength = 0.25f;
+    gif_dither(mapper, rgba, width, height, &options, threaded);
+    size_t full_runs = 0, weak_runs = 0;
+    for (int i = 1; i < width * height; i++) {
+        full_runs += diffused[i] != diffused[i - 1];
+        weak_runs += threaded[i] != threaded[i - 1];
+    }
+    munit_assert_size(weak_runs, <, full_runs);
+
+    gif_palette_mapper_destroy(mapper);
+    free(plain);
+    free(ordered);
+    free(diffused);
+    free(threaded);
+    free(rgba);
+
+    return MUNIT_OK;
+}
+
 static MunitTest tests[] = {
     {
       "test_encode_16",       /* name */
@@ -538,6 +2589,206 @@ static MunitTest tests[] = {
       MUNIT_TEST_OPTION_NONE, /* options */
       NULL                    /* parameters */
     },
+    {
+      "test_animation_delta", /* name */
+      test_animation_delta,   /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_animation_duplicates", /* name */
+      test_animation_duplicates,   /* test */
+      NULL,                        /* setup */
+      NULL,                        /* tear_down */
+      MUNIT_TEST_OPTION_NONE,      /* options */
+      NULL                         /* parameters */
+    },
+    {
+      "test_export_minimize", /* name */
+      test_export_minimize,   /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_export_palette_order", /* name */
+      test_export_palette_order,   /* test */
+      NULL,                        /* setup */
+      NULL,                        /* tear_down */
+      MUNIT_TEST_OPTION_NONE,      /* options */
+      NULL                         /* parameters */
+    },
+    {
+      "test_clear_strategies", /* name */
+      test_clear_strategies,   /* test */
+      NULL,                    /* setup */
+      NULL,                    /* tear_down */
+      MUNIT_TEST_OPTION_NONE,  /* options */
+      NULL                     /* parameters */
+    },
+    {
+      "test_optimal_parse",   /* name */
+      test_optimal_parse,     /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_lossy",           /* name */
+      test_lossy,             /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_encode_runs",     /* name */
+      test_encode_runs,       /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_decode_code_sizes", /* name */
+      test_decode_code_sizes,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_decode_long_strings", /* name */
+      test_decode_long_strings,   /* test */
+      NULL,                       /* setup */
+      NULL,                       /* tear_down */
+      MUNIT_TEST_OPTION_NONE,     /* options */
+      NULL                        /* parameters */
+    },
+    {
+      "test_decode_interlaced", /* name */
+      test_decode_interlaced,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_export_interlaced", /* name */
+      test_export_interlaced,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_local_color_table", /* name */
+      test_local_color_table,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_probe",           /* name */
+      test_probe,             /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_decode_downscaled", /* name */
+      test_decode_downscaled,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_decode_region",   /* name */
+      test_decode_region,     /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_decode_into_buffer", /* name */
+      test_decode_into_buffer,   /* test */
+      NULL,                      /* setup */
+      NULL,                      /* tear_down */
+      MUNIT_TEST_OPTION_NONE,    /* options */
+      NULL                       /* parameters */
+    },
+    {
+      "test_packed_indices",  /* name */
+      test_packed_indices,    /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_export_view",     /* name */
+      test_export_view,       /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_index_transforms", /* name */
+      test_index_transforms,   /* test */
+      NULL,                    /* setup */
+      NULL,                    /* tear_down */
+      MUNIT_TEST_OPTION_NONE,  /* options */
+      NULL                     /* parameters */
+    },
+    {
+      "test_resample",        /* name */
+      test_resample,          /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_animation_palette", /* name */
+      test_animation_palette,   /* test */
+      NULL,                     /* setup */
+      NULL,                     /* tear_down */
+      MUNIT_TEST_OPTION_NONE,   /* options */
+      NULL                      /* parameters */
+    },
+    {
+      "test_quantize",        /* name */
+      test_quantize,          /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_palette_mapper",  /* name */
+      test_palette_mapper,    /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
+    {
+      "test_dither",          /* name */
+      test_dither,            /* test */
+      NULL,                   /* setup */
+      NULL,                   /* tear_down */
+      MUNIT_TEST_OPTION_NONE, /* options */
+      NULL                    /* parameters */
+    },
     /* Mark the end of the array with an entry where the test
      * function is NULL */
     { NULL, NULL, NULL, NULL, MUNIT_TEST_OPTION_NONE, NULL }